@@ -0,0 +1,121 @@
+#include "arena.h"
+#include <stdlib.h>
+
+namespace GSP {
+
+    thread_local Arena *Arena::_current = nullptr;
+    thread_local MemoryStats *MemoryStats::_current = nullptr;
+
+    /* Malloc() puts this in front of each block, null arena means heap */
+    struct alignas(max_align_t) MallocHeader {
+        Arena   *arena;
+        size_t   size;      /* as requested, for the accounting of Free() */
+    };
+
+    /* in front of heap memory, the stats that counted it. an arena block is never freed and needs none */
+    struct alignas(max_align_t) HeapHeader {
+        MemoryStats *stats;
+    };
+
+    static void *heap_allocate(size_t size, size_t counted) {
+        HeapHeader *h = static_cast<HeapHeader*>(::operator new(sizeof(HeapHeader) + size));
+        h->stats = MemoryStats::Current();
+        if (h->stats != nullptr) {
+            h->stats->Allocated(&h->stats->_ast, counted);
+        }
+        return h + 1;
+    }
+
+    static void heap_free(void *p, size_t counted) {
+        HeapHeader *h = static_cast<HeapHeader*>(p) - 1;
+        if (h->stats != nullptr) {
+            h->stats->Freed(&h->stats->_ast, counted);
+        }
+        ::operator delete(h);
+    }
+
+    Arena::Arena(size_t block_size) : _blocks(nullptr), _ptr(nullptr), _end(nullptr), _block_size(block_size), _used(0) {}
+
+    Arena::~Arena() {
+        for (Block *b = _blocks; b != nullptr;) {
+            Block *next = b->next;
+            free(b);
+            b = next;
+        }
+        _blocks = nullptr;
+    }
+
+    void *Arena::AllocateSlow(size_t size) {
+        size_t header = (sizeof(Block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+        size_t block_size = size + header > _block_size ? size + header : _block_size;
+        Block *b = static_cast<Block*>(malloc(block_size));
+        if (b == nullptr) {
+            throw std::bad_alloc();
+        }
+        b->size = block_size;
+        if (_blocks != nullptr && block_size > _block_size) {
+            /* an oversized block, keep bumping in the current one */
+            b->next = _blocks->next;
+            _blocks->next = b;
+            _used += size;
+            return (char*)b + header;
+        }
+        b->next = _blocks;
+        _blocks = b;
+        _ptr = (char*)b + header + size;
+        _end = (char*)b + block_size;
+        _used += size;
+        return (char*)b + header;
+    }
+
+    void Arena::Reset() {
+        if (_blocks == nullptr) {
+            return;
+        }
+        Block *first = _blocks;
+        while (first->next != nullptr) {
+            Block *b = first;
+            first = first->next;
+            free(b);
+        }
+        _blocks = first;
+        size_t header = (sizeof(Block) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+        _ptr = (char*)first + header;
+        _end = (char*)first + first->size;
+        _used = 0;
+    }
+
+    void *Arena::Malloc(size_t size) {
+        Arena *arena = _current;
+        MallocHeader *h;
+        if (arena != nullptr) {
+            h = static_cast<MallocHeader*>(arena->Allocate(sizeof(MallocHeader) + size));
+            if (MemoryStats *stats = MemoryStats::Current()) {
+                stats->Allocated(&stats->_ast, size);
+            }
+        } else {
+            h = static_cast<MallocHeader*>(heap_allocate(sizeof(MallocHeader) + size, size));
+        }
+        h->arena = arena;
+        h->size = size;
+        return h + 1;
+    }
+
+    void Arena::Free(void *p) {
+        if (p == nullptr) {
+            return;
+        }
+        MallocHeader *h = static_cast<MallocHeader*>(p) - 1;
+        if (h->arena == nullptr) {
+            heap_free(h, h->size);
+        }
+    }
+
+    void *Arena::HeapAllocate(size_t size) {
+        return heap_allocate(size, size);
+    }
+
+    void Arena::HeapFree(void *p, size_t size) {
+        heap_free(p, size);
+    }
+}
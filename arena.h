@@ -0,0 +1,159 @@
+#ifndef GSP_ARENA_H
+#define GSP_ARENA_H
+
+#include <stddef.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <type_traits>
+
+namespace GSP {
+
+    /*
+     * bump allocator for the nodes of one parse. memory is handed out from large blocks and only
+     * given back all at once, by Reset() or the destructor; ast destructors are not run then.
+     * the arena of the current thread is installed with ArenaScope, everything allocated through
+     * ArenaObject, ArenaAllocator or Arena::Malloc while it is installed comes from it.
+     */
+    class Arena {
+    public:
+        explicit Arena(size_t block_size = 16 * 1024);
+        ~Arena();
+        void           *Allocate(size_t size);     /* aligned to alignof(max_align_t) */
+        void            Reset();                    /* free everything, keep the first block for reuse */
+        size_t          GetUsed() const { return _used; }
+        static Arena   *Current() { return _current; }
+        /* allocate from the current arena or, without one, from the heap. Free() knows which */
+        static void    *Malloc(size_t size);
+        static void     Free(void *p);
+        /* heap memory for ArenaAllocator, counted in _ast of the current stats and freed back to the same stats */
+        static void    *HeapAllocate(size_t size);
+        static void     HeapFree(void *p, size_t size);
+    private:
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        void           *AllocateSlow(size_t size);
+        struct Block {
+            Block  *next;
+            size_t  size;
+        };
+        Block                      *_blocks;       /* newest first */
+        char                       *_ptr;
+        char                       *_end;
+        size_t                      _block_size;
+        size_t                      _used;
+        static thread_local Arena  *_current;
+        friend class ArenaScope;
+    };
+
+    inline void *Arena::Allocate(size_t size) {
+        size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+        if ((size_t)(_end - _ptr) < size) {
+            return AllocateSlow(size);
+        }
+        void *p = _ptr;
+        _ptr += size;
+        _used += size;
+        return p;
+    }
+
+    /* install arena as the current one of this thread until the scope ends, null means the heap */
+    class ArenaScope {
+    public:
+        explicit ArenaScope(Arena *arena) : _prev(Arena::_current) { Arena::_current = arena; }
+        ~ArenaScope() { Arena::_current = _prev; }
+    private:
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+        Arena *_prev;
+    };
+
+    /* allocations of one kind, sizes as requested */
+    struct MemoryCounter {
+        size_t  allocs = 0;
+        size_t  bytes = 0;      /* allocated in total */
+        size_t  live = 0;       /* allocated and not freed yet */
+        size_t  peak = 0;       /* highest live */
+    };
+
+    /*
+     * memory accounting of the lexers and the ast allocators of one thread, installed with MemoryScope.
+     * _ast counts what goes through ArenaObject, ArenaAllocator and Arena::Malloc: the nodes, their
+     * containers and the temporary vectors of the parser. after a parse and the free_lex() of its lexer,
+     * _ast.live is the retained size of the tree and _ast.bytes - _ast.live what parsing threw away.
+     * memory of an arena is given back by Reset(), which is not seen, it stays live. a free is counted
+     * by the stats that counted the allocation, whichever are current, and not at all when none did,
+     * so live never drops below what is still allocated. without stats an allocation costs one more
+     * thread local test.
+     */
+    struct MemoryStats {
+        void    Allocated(MemoryCounter *c, size_t size) {
+            ++c->allocs;
+            c->bytes += size;
+            c->live += size;
+            if (c->live > c->peak) c->peak = c->live;
+            if (_lex.live + _ast.live > _peak) _peak = _lex.live + _ast.live;
+        }
+        void    Freed(MemoryCounter *c, size_t size) { c->live -= size; }
+        static MemoryStats *Current() { return _current; }
+        MemoryCounter   _lex;           /* the lexers: their copy of the sql, token arrays */
+        MemoryCounter   _ast;
+        size_t          _peak = 0;      /* highest _lex.live + _ast.live */
+    private:
+        static thread_local MemoryStats *_current;
+        friend class MemoryScope;
+    };
+
+    /* count into stats on this thread until the scope ends, null stops counting */
+    class MemoryScope {
+    public:
+        explicit MemoryScope(MemoryStats *stats) : _prev(MemoryStats::_current) { MemoryStats::_current = stats; }
+        ~MemoryScope() { MemoryStats::_current = _prev; }
+    private:
+        MemoryScope(const MemoryScope&) = delete;
+        MemoryScope& operator=(const MemoryScope&) = delete;
+        MemoryStats *_prev;
+    };
+
+    /* base of the ast classes, new takes the current arena, delete of an arena object only runs the destructor */
+    class ArenaObject {
+    public:
+        static void *operator new(size_t size) { return Arena::Malloc(size); }
+        static void  operator delete(void *p) { Arena::Free(p); }
+    };
+
+    /* std allocator bound to the arena current at construction, containers of an arena node live in it too */
+    template <typename T>
+    class ArenaAllocator {
+    public:
+        typedef T               value_type;
+        typedef std::true_type  propagate_on_container_move_assignment;
+        typedef std::true_type  propagate_on_container_swap;
+        ArenaAllocator() : _arena(Arena::Current()) {}
+        explicit ArenaAllocator(Arena *arena) : _arena(arena) {}
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.GetArena()) {}
+        T *allocate(size_t n) {
+            if (_arena == nullptr) return static_cast<T*>(Arena::HeapAllocate(n * sizeof(T)));
+            if (MemoryStats *stats = MemoryStats::Current()) stats->Allocated(&stats->_ast, n * sizeof(T));
+            return static_cast<T*>(_arena->Allocate(n * sizeof(T)));
+        }
+        void deallocate(T *p, size_t n) {
+            if (_arena == nullptr) Arena::HeapFree(p, n * sizeof(T));
+        }
+        Arena *GetArena() const { return _arena; }
+    private:
+        Arena *_arena;
+    };
+
+    template <typename T, typename U>
+    inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.GetArena() == b.GetArena(); }
+    template <typename T, typename U>
+    inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) { return a.GetArena() != b.GetArena(); }
+
+    template <typename T>
+    using AstVector = std::vector<T, ArenaAllocator<T> >;
+    typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > AstString;
+}
+
+#endif
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast_file.h"
+
+namespace GSP {
+
+    struct AstFileHeader {
+        char        magic[4];
+        uint32_t    version;
+        uint32_t    kinds;      /* FlatAst::F_LIST + 1 of the writer */
+        uint32_t    nodes;
+        uint32_t    children;
+        uint32_t    strings;
+        uint32_t    roots;
+        uint32_t    reserved;
+    };
+
+    static const char MAGIC[4] = { 'G', 'S', 'P', 'A' };
+
+    /* bytes after the header, the uint32 arrays come first so they stay aligned */
+    static size_t body_length(const AstFileHeader& h) {
+        return (size_t)4 * ((size_t)h.roots + h.nodes + h.nodes + 1 + h.children) + (size_t)2 * h.nodes + h.strings;
+    }
+
+    /* what a child slot may hold */
+    enum SLOT { S_EXPR, S_SELECT, S_WITH, S_BODY, S_TABLE, S_ID, S_CTE, S_PROJECTION, S_ORDER_ITEM };
+
+    static bool fits(const FlatAst& ast, uint32_t c, SLOT slot, bool nil) {
+        if (c == FlatAst::NIL) {
+            return nil;
+        }
+        uint8_t k = ast.GetKind(c);
+        switch (slot) {
+            case S_EXPR: return k < FlatAst::F_SELECT;
+            case S_SELECT: return k == FlatAst::F_SELECT;
+            case S_WITH: return k == FlatAst::F_WITH;
+            case S_BODY: return k == FlatAst::F_QUERY_PRIMARY || k == FlatAst::F_QUERY_SET;
+            case S_TABLE: return k == FlatAst::F_RELATION || k == FlatAst::F_SUBQUERY_TABLE || k == FlatAst::F_JOIN;
+            case S_ID: return k == FlatAst::F_ID;
+            case S_CTE: return k == FlatAst::F_CTE;
+            case S_PROJECTION: return k == FlatAst::F_PROJECTION;
+            default: return k == FlatAst::F_ORDER_ITEM;
+        }
+    }
+
+    /* an F_LIST of items of one slot */
+    static bool fits_list(const FlatAst& ast, uint32_t c, SLOT slot) {
+        if (c == FlatAst::NIL || ast.GetKind(c) != FlatAst::F_LIST) {
+            return false;
+        }
+        for (uint32_t i = 0; i < ast.GetChildCount(c); ++i) {
+            if (!fits(ast, ast.GetChild(c, i), slot, false)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* children from i on all fit slot */
+    static bool fits_rest(const FlatAst& ast, uint32_t n, uint32_t i, SLOT slot, bool nil) {
+        for (; i < ast.GetChildCount(n); ++i) {
+            if (!fits(ast, ast.GetChild(n, i), slot, nil)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* node n has the children and value the table of flat_ast.h gives its kind, its children are already checked */
+    static bool check_node(const FlatAst& ast, uint32_t n) {
+        uint8_t k = ast.GetKind(n);
+        uint32_t count = ast.GetChildCount(n);
+        bool value = k == FlatAst::F_ID || k == AstExpr::C_NUMBER || k == AstExpr::C_STRING;
+        if ((ast.GetValue(n) != nullptr) != value) {
+            return false;
+        }
+        auto child = [&](uint32_t i) { return ast.GetChild(n, i); };
+        switch (k) {
+            case FlatAst::F_SELECT:
+                return count == 3 && fits(ast, child(0), S_WITH, true) && fits(ast, child(1), S_BODY, true) &&
+                       fits_list(ast, child(2), S_ORDER_ITEM);
+            case FlatAst::F_WITH:
+                return fits_rest(ast, n, 0, S_CTE, false);
+            case FlatAst::F_CTE:
+                return count == 3 && fits(ast, child(0), S_ID, true) && fits_list(ast, child(1), S_ID) &&
+                       fits(ast, child(2), S_SELECT, true);
+            case FlatAst::F_QUERY_PRIMARY:
+                return count == 5 && fits_list(ast, child(0), S_PROJECTION) && fits_list(ast, child(1), S_TABLE) &&
+                       fits(ast, child(2), S_EXPR, true) && fits_list(ast, child(3), S_EXPR) && fits(ast, child(4), S_EXPR, true);
+            case FlatAst::F_QUERY_SET:
+                return count == 2 && fits_rest(ast, n, 0, S_BODY, false);
+            case FlatAst::F_PROJECTION:
+                return count == 2 && fits(ast, child(0), S_EXPR, true) && fits(ast, child(1), S_ID, true);
+            case FlatAst::F_ORDER_ITEM:
+                return count == 1 && fits(ast, child(0), S_EXPR, true);
+            case FlatAst::F_RELATION:
+                return count >= 1 && fits(ast, child(0), S_ID, true) && fits_rest(ast, n, 1, S_ID, false);
+            case FlatAst::F_SUBQUERY_TABLE:
+                return count == 3 && fits(ast, child(0), S_SELECT, true) && fits(ast, child(1), S_ID, true) &&
+                       fits_list(ast, child(2), S_ID);
+            case FlatAst::F_JOIN:
+                return count == 3 && fits(ast, child(0), S_TABLE, false) && fits(ast, child(1), S_TABLE, false) &&
+                       fits(ast, child(2), S_EXPR, true);
+            case FlatAst::F_ID:
+                return count == 0;
+            case FlatAst::F_LIST:
+                return true;        /* its items are checked with the parent, which knows what they are */
+            case AstExpr::EXISTS: case AstExpr::EXPR_SUBQUERY:
+                return count == 1 && fits(ast, child(0), S_SELECT, true);
+            case AstExpr::EXPR_LIST:
+                return fits_rest(ast, n, 0, S_EXPR, true);
+            case AstExpr::EXPR_CASE:
+                return count >= 2 && count % 2 == 0 && fits_rest(ast, n, 0, S_EXPR, true);
+            case AstExpr::EXPR_FUNC:
+                return count == 2 && fits_list(ast, child(0), S_ID) &&
+                       (child(1) == FlatAst::NIL || ast.GetKind(child(1)) == AstExpr::EXPR_LIST);
+            case AstExpr::EXPR_COLUMN_REF:
+                return fits_rest(ast, n, 0, S_ID, false);
+            case AstExpr::LIKE: case AstExpr::NOT_LIKE: case AstExpr::BETWEEN: case AstExpr::NOT_BETWEEN:
+                return count == 3 && fits_rest(ast, n, 0, S_EXPR, true);
+            case AstExpr::IN: case AstExpr::NOT_IN:
+                return count == 2 && fits_rest(ast, n, 0, S_EXPR, true);
+            default:
+                if (k >= AstExpr::C_QUES && k <= AstExpr::C_STRING) {
+                    return count == 0;
+                }
+                if (k >= AstExpr::COMP_LE_ALL && k <= AstExpr::COMP_NEQ_ANY) {
+                    return count == 2 && fits(ast, child(0), S_EXPR, true) && fits(ast, child(1), S_SELECT, true);
+                }
+                if (k >= AstExpr::NOT && k <= AstExpr::U_NEGATIVE) {
+                    return count == 1 && fits(ast, child(0), S_EXPR, true);
+                }
+                return k <= AstExpr::CARET && count == 2 && fits_rest(ast, n, 0, S_EXPR, true);
+        }
+    }
+
+    /*
+     * the arrays point only inside the file: child ranges ascend, a child is NIL or comes before its
+     * parent as Save() writes them, so a walk from a root ends, and a value starts in the string pool.
+     * each node has the children and value its kind has, so the readers of FlatAst find what they index
+     */
+    bool AstFile::Check(uint32_t children) const {
+        const FlatAst &ast = _ast;
+        uint32_t nodes = ast._size, strings = ast._string_size;
+        for (uint32_t i = 0; i < _root_count; ++i) {
+            if (_roots[i] != FlatAst::NIL && _roots[i] >= nodes) {
+                return false;
+            }
+        }
+        if (strings > 0 && ast._string_p[strings - 1] != '\0') {
+            return false;
+        }
+        if (ast._first_child_p[0] != 0 || ast._first_child_p[nodes] != children) {
+            return false;
+        }
+        for (uint32_t n = 0; n < nodes; ++n) {
+            if (ast._kind_p[n] > FlatAst::F_LIST || ast._first_child_p[n] > ast._first_child_p[n + 1] ||
+                    (ast._value_p[n] != FlatAst::NIL && ast._value_p[n] >= strings)) {
+                return false;
+            }
+            for (uint32_t c = ast._first_child_p[n]; c < ast._first_child_p[n + 1]; ++c) {
+                if (ast._children_p[c] != FlatAst::NIL && ast._children_p[c] >= n) {
+                    return false;
+                }
+            }
+            if (!check_node(ast, n)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    AstFile::AstFile() : _data(nullptr), _length(0), _roots(nullptr), _root_count(0) {}
+
+    AstFile::~AstFile() {
+        Close();
+    }
+
+    bool AstFile::Save(const char *path, const FlatAst& ast, const std::vector<uint32_t>& roots) {
+        uint32_t n = ast.Size();
+        AstFileHeader h;
+        memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = VERSION;
+        h.kinds = FlatAst::F_LIST + 1;
+        h.nodes = n;
+        h.children = ast._first_child_p[n];
+        h.strings = ast._string_size;
+        h.roots = (uint32_t)roots.size();
+        h.reserved = 0;
+
+        FILE *f = fopen(path, "wb");
+        if (f == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  fwrite(roots.data(), 4, h.roots, f) == h.roots &&
+                  fwrite(ast._value_p, 4, n, f) == n &&
+                  fwrite(ast._first_child_p, 4, n + 1, f) == n + 1 &&
+                  fwrite(ast._children_p, 4, h.children, f) == h.children &&
+                  fwrite(ast._kind_p, 1, n, f) == n &&
+                  fwrite(ast._flag_p, 1, n, f) == n &&
+                  fwrite(ast._string_p, 1, h.strings, f) == h.strings;
+        ok = fclose(f) == 0 && ok;
+        return ok;
+    }
+
+    bool AstFile::Open(const char *path) {
+        Close();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(AstFileHeader)) {
+            close(fd);
+            return false;
+        }
+        void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        _data = data;
+        _length = (size_t)st.st_size;
+
+        const AstFileHeader *h = static_cast<const AstFileHeader*>(data);
+        if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->version != VERSION || h->kinds != FlatAst::F_LIST + 1 ||
+                _length < sizeof(AstFileHeader) + body_length(*h)) {
+            Close();
+            return false;
+        }
+        const uint32_t *p = reinterpret_cast<const uint32_t*>(h + 1);
+        _roots = p;
+        _root_count = h->roots;
+        p += h->roots;
+        _ast._value_p = p;
+        p += h->nodes;
+        _ast._first_child_p = p;
+        p += h->nodes + 1;
+        _ast._children_p = p;
+        p += h->children;
+        const uint8_t *b = reinterpret_cast<const uint8_t*>(p);
+        _ast._kind_p = b;
+        _ast._flag_p = b + h->nodes;
+        _ast._string_p = reinterpret_cast<const char*>(b + 2 * (size_t)h->nodes);
+        _ast._size = h->nodes;
+        _ast._string_size = h->strings;
+        _ast._mapped = true;
+        if (!Check(h->children)) {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void AstFile::Close() {
+        if (_data != nullptr) {
+            munmap(_data, _length);
+            _data = nullptr;
+        }
+        _length = 0;
+        _roots = nullptr;
+        _root_count = 0;
+        _ast.Clear();
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef GSP_AST_FILE_H
+#define GSP_AST_FILE_H
+
+#include <stdint.h>
+#include <vector>
+#include "flat_ast.h"
+
+namespace GSP {
+
+    /*
+     * a FlatAst on disk. the arrays are written as they are in memory, Open() maps the file and points
+     * the pool into the mapping, so loading costs no parse and no allocation per node.
+     *
+     *   header  magic "GSPA", version, kinds, nodes, children, strings bytes, roots, 0     8 x uint32
+     *   roots       uint32 x roots
+     *   values      uint32 x nodes
+     *   first_child uint32 x (nodes + 1)
+     *   children    uint32 x children
+     *   kinds       uint8 x nodes
+     *   flags       uint8 x nodes
+     *   strings     char x strings bytes
+     *
+     * numbers are in host byte order, a file is for the machine that wrote it. bump VERSION with any
+     * change of the layout or of FlatAst::NODE_KIND
+     */
+    class AstFile {
+    public:
+        static const uint32_t VERSION = 1;
+
+        AstFile();
+        ~AstFile();
+        /* false on io error */
+        static bool     Save(const char *path, const FlatAst& ast, const std::vector<uint32_t>& roots);
+        /* false when the file cannot be mapped, was not written by Save of this version or is corrupt */
+        bool            Open(const char *path);
+        void            Close();
+
+        /* valid until Close(), read only */
+        const FlatAst&  GetAst() const { return _ast; }
+        uint32_t        GetRootCount() const { return _root_count; }
+        uint32_t        GetRoot(uint32_t i) const { return _roots[i]; }
+    private:
+        AstFile(const AstFile&) = delete;
+        AstFile& operator=(const AstFile&) = delete;
+        bool            Check(uint32_t children) const;
+
+        FlatAst             _ast;
+        void               *_data;
+        size_t              _length;
+        const uint32_t     *_roots;
+        uint32_t            _root_count;
+    };
+}
+
+#endif
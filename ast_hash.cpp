@@ -0,0 +1,299 @@
+#include <string.h>
+#include <vector>
+#include "ast_hash.h"
+#include "flat_ast.h"
+#include "sql_select_stmt.h"
+#include "sql_expression.h"
+#include "visitor.h"
+
+namespace GSP {
+
+    static const uint64_t FNV_BASIS = 14695981039346656037ULL;
+    static const uint64_t NIL_HASH = 0x9e3779b97f4a7c15ULL;    /* of an absent child */
+
+    static inline uint64_t mix(uint64_t h, uint64_t v) {
+        return (h ^ v) * 1099511628211ULL;
+    }
+
+    static uint64_t mix(uint64_t h, const char *s) {
+        for (; *s; ++s) {
+            h = mix(h, (unsigned char)*s);
+        }
+        return mix(h, 0xff);
+    }
+
+    /* a node without its child expressions */
+    struct ExprShape {
+        AstExpr::EXPR_TYPE      kind;
+        const char             *value;      /* constants */
+        bool                    wild;       /* column ref */
+        const AstIds           *ids;        /* column ref, function name */
+        AstSelectStmt          *query;      /* subquery, EXISTS, quantified compare */
+        std::vector<AstExpr*>   children;   /* null when absent */
+    };
+
+    /* the children in the order of flat_ast.h */
+    struct ShapeVisitor : public AstVisitor<ShapeVisitor> {
+        ExprShape *s;
+
+        void VisitBinaryOp(AstBinaryOpExpr *expr) { s->children = { expr->GetLeft(), expr->GetRight() }; }
+        void VisitUnaryOp(AstUnaryOpExpr *expr) { s->children = { expr->GetExpr() }; }
+        void VisitQuantifiedCompare(AstQuantifiedCompareExpr *expr) { s->children = { expr->GetLeft() }; s->query = expr->GetQuery(); }
+        void VisitExists(AstExistsExpr *expr) { s->query = expr->GetQuery(); }
+        void VisitIn(AstInExpr *expr) { s->children = { expr->GetLeft(), expr->GetIn() }; }
+        void VisitBetween(AstBetweenExpr *expr) { s->children = { expr->GetLeft(), expr->GetFrom(), expr->GetTo() }; }
+        void VisitLike(AstLikeExpr *expr) { s->children = { expr->GetLeft(), expr->GetRight(), expr->GetEscape() }; }
+        void VisitConstant(AstConstantValue *expr) {
+            if (s->kind == AstExpr::C_NUMBER || s->kind == AstExpr::C_STRING) {
+                s->value = expr->GetValue();
+            }
+        }
+        void VisitSubquery(AstSubqueryExpr *expr) { s->query = expr->GetQuery(); }
+        void VisitExprList(AstExprList *expr) { s->children.assign(expr->GetExprs().begin(), expr->GetExprs().end()); }
+        void VisitCase(AstCaseExpr *expr) {
+            s->children = { expr->GetArg(), expr->GetElse() };
+            for (size_t i = 0; i < expr->GetWhenList().size(); ++i) {
+                s->children.push_back(expr->GetWhenList()[i]);
+                s->children.push_back(expr->GetThenList()[i]);
+            }
+        }
+        void VisitFuncCall(AstFuncCall *expr) { s->ids = &expr->GetFuncName(); s->children = { expr->GetParams() }; }
+        void VisitColumnRef(AstColumnRef *expr) { s->ids = &expr->GetColumn(); s->wild = expr->IsWild(); }
+    };
+
+    static void describe(AstExpr *expr, ExprShape *s) {
+        s->kind = expr->GetExprType();
+        s->value = nullptr;
+        s->wild = false;
+        s->ids = nullptr;
+        s->query = nullptr;
+        s->children.clear();
+        ShapeVisitor visitor;
+        visitor.s = s;
+        visitor.Visit(expr);
+    }
+
+    static uint64_t shape_hash(const ExprShape& s, const std::vector<uint64_t>& child_hashes) {
+        uint64_t h = mix(FNV_BASIS, s.kind);
+        if (s.value != nullptr) {
+            h = mix(h, s.value);
+        }
+        h = mix(h, s.wild);
+        if (s.ids != nullptr) {
+            for (auto it : *s.ids) h = mix(h, it->GetId().c_str());
+        }
+        if (s.query != nullptr) {
+            h = mix(h, ast_hash(s.query));
+        }
+        for (auto it : child_hashes) h = mix(h, it);
+        return h;
+    }
+
+    /* all but the children */
+    static bool same_node(const ExprShape& a, const ExprShape& b) {
+        if (a.kind != b.kind || a.wild != b.wild || a.children.size() != b.children.size()) {
+            return false;
+        }
+        if ((a.value == nullptr) != (b.value == nullptr) || (a.value != nullptr && strcmp(a.value, b.value) != 0)) {
+            return false;
+        }
+        if ((a.ids == nullptr) != (b.ids == nullptr)) {
+            return false;
+        }
+        if (a.ids != nullptr) {
+            if (a.ids->size() != b.ids->size()) {
+                return false;
+            }
+            for (size_t i = 0; i < a.ids->size(); ++i) {
+                if ((*a.ids)[i]->GetId() != (*b.ids)[i]->GetId()) {
+                    return false;
+                }
+            }
+        }
+        return a.query == b.query || ast_equal(a.query, b.query);
+    }
+
+    uint64_t ast_hash(AstExpr *expr) {
+        if (expr == nullptr) {
+            return NIL_HASH;
+        }
+        ExprShape s;
+        describe(expr, &s);
+        std::vector<uint64_t> child_hashes;
+        for (auto it : s.children) child_hashes.push_back(ast_hash(it));
+        return shape_hash(s, child_hashes);
+    }
+
+    bool ast_equal(AstExpr *a, AstExpr *b) {
+        if (a == b) {
+            return true;
+        }
+        if (a == nullptr || b == nullptr || a->GetExprType() != b->GetExprType()) {
+            return false;
+        }
+        ExprShape sa, sb;
+        describe(a, &sa);
+        describe(b, &sb);
+        if (!same_node(sa, sb)) {
+            return false;
+        }
+        for (size_t i = 0; i < sa.children.size(); ++i) {
+            if (!ast_equal(sa.children[i], sb.children[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* statements are compared in their flat form, where a tree is a few arrays */
+    uint64_t ast_hash(AstSelectStmt *stmt) {
+        if (stmt == nullptr) {
+            return NIL_HASH;
+        }
+        FlatAst flat;
+        flat.Append(stmt);
+        uint64_t h = FNV_BASIS;
+        for (uint32_t n = 0; n < flat.Size(); ++n) {
+            h = mix(h, flat.GetKind(n));
+            h = mix(h, flat.GetFlag(n));
+            for (uint32_t i = 0; i < flat.GetChildCount(n); ++i) {
+                uint32_t c = flat.GetChild(n, i);
+                h = mix(h, c == FlatAst::NIL ? 0 : n - c);
+            }
+            if (flat.GetValue(n) != nullptr) {
+                h = mix(h, flat.GetValue(n));
+            }
+        }
+        return h;
+    }
+
+    bool ast_equal(AstSelectStmt *a, AstSelectStmt *b) {
+        if (a == b) {
+            return true;
+        }
+        if (a == nullptr || b == nullptr) {
+            return false;
+        }
+        FlatAst fa, fb;
+        fa.Append(a);
+        fb.Append(b);
+        if (fa.Size() != fb.Size()) {
+            return false;
+        }
+        for (uint32_t n = 0; n < fa.Size(); ++n) {
+            if (fa.GetKind(n) != fb.GetKind(n) || fa.GetFlag(n) != fb.GetFlag(n) || fa.GetChildCount(n) != fb.GetChildCount(n)) {
+                return false;
+            }
+            for (uint32_t i = 0; i < fa.GetChildCount(n); ++i) {
+                if (fa.GetChild(n, i) != fb.GetChild(n, i)) {
+                    return false;
+                }
+            }
+            const char *va = fa.GetValue(n), *vb = fb.GetValue(n);
+            if ((va == nullptr) != (vb == nullptr) || (va != nullptr && strcmp(va, vb) != 0)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static AstIds copy_ids(const AstIds& ids) {
+        AstIds r;
+        for (auto it : ids) r.push_back(new AstId(it->GetId().c_str()));
+        return r;
+    }
+
+    static AstSelectStmt *copy_query(AstSelectStmt *query) {
+        FlatAst flat;
+        return flat.ToSelectStmt(flat.Append(query));
+    }
+
+    /* a new node of shape s, its children are already canonical */
+    static AstExpr *build(const ExprShape& s) {
+        AstExpr::EXPR_TYPE tp = s.kind;
+        const std::vector<AstExpr*>& c = s.children;
+        switch (tp) {
+            case AstExpr::NOT: case AstExpr::IS_TRUE: case AstExpr::IS_NOT_TRUE: case AstExpr::IS_FALSE:
+            case AstExpr::IS_NOT_FALSE: case AstExpr::IS_UNKNOWN: case AstExpr::IS_NOT_UNKNOWN:
+            case AstExpr::IS_NULL: case AstExpr::IS_NOT_NULL: case AstExpr::U_POSITIVE: case AstExpr::U_NEGATIVE:
+                return new AstUnaryOpExpr(tp, c[0]);
+            case AstExpr::LIKE: case AstExpr::NOT_LIKE:
+                return new AstLikeExpr(tp, c[0], c[1], c[2]);
+            case AstExpr::BETWEEN: case AstExpr::NOT_BETWEEN:
+                return new AstBetweenExpr(tp, c[0], c[1], c[2]);
+            case AstExpr::IN: case AstExpr::NOT_IN:
+                return new AstInExpr(tp, c[0], c[1]);
+            case AstExpr::EXISTS:
+                return new AstExistsExpr(copy_query(s.query));
+            case AstExpr::C_QUES: case AstExpr::C_TRUE: case AstExpr::C_FALSE: case AstExpr::C_UNKNOWN:
+            case AstExpr::C_DEFAULT: case AstExpr::C_NULL: case AstExpr::C_NUMBER: case AstExpr::C_STRING: {
+                AstConstantValue *r = new AstConstantValue(tp);
+                if (s.value != nullptr) {
+                    r->SetValue(s.value);
+                }
+                return r;
+            }
+            case AstExpr::EXPR_SUBQUERY:
+                return new AstSubqueryExpr(copy_query(s.query));
+            case AstExpr::EXPR_LIST: {
+                AstExprs exprs;
+                exprs.assign(c.begin(), c.end());
+                return new AstExprList(exprs);
+            }
+            case AstExpr::EXPR_CASE: {
+                AstCaseExpr *r = new AstCaseExpr();
+                r->SetArg(c[0]);
+                AstExprs when_list, then_list;
+                for (size_t i = 2; i < c.size(); i += 2) {
+                    when_list.push_back(c[i]);
+                    then_list.push_back(c[i + 1]);
+                }
+                r->SetWhenList(when_list);
+                r->SetThenList(then_list);
+                r->SetElse(c[1]);
+                return r;
+            }
+            case AstExpr::EXPR_FUNC:
+                return new AstFuncCall(copy_ids(*s.ids), static_cast<AstExprList*>(c[0]));
+            case AstExpr::EXPR_COLUMN_REF:
+                return new AstColumnRef(copy_ids(*s.ids), s.wild);
+            default:
+                if (tp >= AstExpr::COMP_LE_ALL && tp <= AstExpr::COMP_NEQ_ANY) {
+                    return new AstQuantifiedCompareExpr(tp, c[0], copy_query(s.query));
+                }
+                assert(tp <= AstExpr::CARET);
+                return new AstBinaryOpExpr(tp, c[0], c[1]);
+        }
+    }
+
+    AstExpr *ExprInterner::Intern(AstExpr *expr) {
+        if (expr == nullptr || _hashes.find(expr) != _hashes.end()) {
+            return expr;
+        }
+        ExprShape s;
+        describe(expr, &s);
+        std::vector<uint64_t> child_hashes;
+        for (auto &it : s.children) {
+            it = Intern(it);
+            child_hashes.push_back(it == nullptr ? NIL_HASH : _hashes[it]);
+        }
+        uint64_t h = shape_hash(s, child_hashes);
+        /* the children are canonical, equal subtrees are the same node */
+        auto range = _nodes.equal_range(h);
+        ExprShape other;
+        for (auto it = range.first; it != range.second; ++it) {
+            describe(it->second, &other);
+            if (other.children == s.children && same_node(s, other)) {
+                return it->second;
+            }
+        }
+        AstExpr *r;
+        {
+            ArenaScope scope(&_arena);
+            r = build(s);
+        }
+        _nodes.emplace(h, r);
+        _hashes[r] = h;
+        return r;
+    }
+}
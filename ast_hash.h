@@ -0,0 +1,42 @@
+#ifndef GSP_AST_HASH_H
+#define GSP_AST_HASH_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include "arena.h"
+
+namespace GSP {
+    class AstExpr;
+    class AstSelectStmt;
+
+    /*
+     * structural hash and equality. two trees are equal when they have the same kinds, the same shape,
+     * the same identifiers and the same constant text; equal trees hash the same.
+     */
+    uint64_t    ast_hash    (AstExpr *expr);
+    uint64_t    ast_hash    (AstSelectStmt *stmt);
+    bool        ast_equal   (AstExpr *a, AstExpr *b);
+    bool        ast_equal   (AstSelectStmt *a, AstSelectStmt *b);
+
+    /*
+     * hash consing. Intern() returns the canonical copy of an expression, structurally equal expressions
+     * get the same node and equal subexpressions share one. the copies live in the interner's arena and
+     * must not be deleted; subqueries are copied whole and not shared.
+     */
+    class ExprInterner {
+    public:
+        ExprInterner() {}
+        AstExpr    *Intern(AstExpr *expr);
+        size_t      GetSize() const { return _hashes.size(); }     /* distinct nodes */
+        uint64_t    GetHash(AstExpr *canonical) const { return _hashes.at(canonical); }
+    private:
+        ExprInterner(const ExprInterner&) = delete;
+        ExprInterner& operator=(const ExprInterner&) = delete;
+
+        Arena                                           _arena;
+        std::unordered_multimap<uint64_t, AstExpr*>     _nodes;     /* by ast_hash */
+        std::unordered_map<AstExpr*, uint64_t>          _hashes;    /* ast_hash of each canonical node */
+    };
+}
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * gsp_bench: parse throughput and latency over a fixed corpus.
+ *
+ *   gsp_bench [--rounds N] [--json FILE] [--baseline FILE] [--tolerance PCT]
+ *
+ * every corpus is parsed with the heap and with an arena, the results go to stdout and, with --json,
+ * to FILE. with --baseline the run is compared to an earlier --json output and the exit code is 1 when
+ * the throughput of a corpus dropped by more than PCT percent (default 10) or a parse allocates more
+ * than before. the latency percentiles pool statements of different sizes and are only reported.
+ * memory is measured by one more parse of each statement under a GSP::MemoryScope: the highest peak of
+ * live bytes, lexer and ast, and the mean size of the finished trees; a peak above the baseline by more
+ * than PCT percent also fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
+#include <string>
+#include <vector>
+#include "lex.h"
+#include "parse_exception.h"
+#include "parse_expression.h"
+#include "parse_select_stmt.h"
+#include "sql_select_stmt.h"
+#include "sql_expression.h"
+#include "arena.h"
+
+/* every heap allocation of the process, the arena takes its blocks with malloc and is not counted */
+static unsigned long long g_allocs = 0;
+
+void *operator new(size_t size) {
+    ++g_allocs;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Corpus {
+    std::string                 name;
+    bool                        condition;      /* parse_search_condition instead of parse_select_stmt */
+    std::vector<std::string>    stmts;
+};
+
+struct Result {
+    std::string     name;           /* corpus/mode */
+    size_t          stmts;
+    size_t          bytes;
+    size_t          tokens;
+    double          stmts_per_sec;
+    double          tokens_per_sec;
+    double          bytes_per_sec;
+    double          allocs_per_parse;
+    double          p50_us;
+    double          p99_us;
+    size_t          peak_bytes;
+    size_t          retained_bytes;     /* mean over the statements */
+};
+
+/* the TPC-H and TPC-DS style statements of main.cpp */
+static Corpus tpcds_corpus() {
+    Corpus c{"tpcds", false, {}};
+    c.stmts.push_back(
+        "select cou1nt(*) \n"
+        "from ((select distinct c_last_name, c_first_name, d_date\n"
+        "       from store_sales, date_dim, customer\n"
+        "       where store_sales.ss_sold_date_sk = date_dim.d_date_sk\n"
+        "         and store_sales.ss_customer_sk = customer.c_customer_sk\n"
+        "         and d_month_seq between 1202 and 1202+11)\n"
+        "       except\n"
+        "      (select distinct c_last_name, c_first_name, d_date\n"
+        "       from catalog_sales, date_dim, customer\n"
+        "       where catalog_sales.cs_sold_date_sk = date_dim.d_date_sk\n"
+        "         and catalog_sales.cs_bill_customer_sk = customer.c_customer_sk\n"
+        "         and d_month_seq between 1202 and 1202+11)\n"
+        "       except\n"
+        "      (select distinct c_last_name, c_first_name, d_date\n"
+        "       from web_sales, date_dim, customer\n"
+        "       where web_sales.ws_sold_date_sk = date_dim.d_date_sk\n"
+        "         and web_sales.ws_bill_customer_sk = customer.c_customer_sk\n"
+        "         and d_month_seq between 1202 and 1202+11)\n"
+        ") cool_cust");
+    c.stmts.push_back(
+        "select i_brand_id brand_id, i_brand brand,t_hour,t_minute,\n"
+        " \tsu1m(ext_price) ext_price\n"
+        " from item, (select ws_ext_sales_price as ext_price, \n"
+        "                        ws_sold_date_sk as sold_date_sk,\n"
+        "                        ws_item_sk as sold_item_sk,\n"
+        "                        ws_sold_time_sk as time_sk  \n"
+        "                 from web_sales,date_dim\n"
+        "                 where d_date_sk = ws_sold_date_sk\n"
+        "                   and d_moy=12\n"
+        "                   and d_year=2002\n"
+        "                 union all\n"
+        "                 select cs_ext_sales_price as ext_price,\n"
+        "                        cs_sold_date_sk as sold_date_sk,\n"
+        "                        cs_item_sk as sold_item_sk,\n"
+        "                        cs_sold_time_sk as time_sk\n"
+        "                 from catalog_sales,date_dim\n"
+        "                 where d_date_sk = cs_sold_date_sk\n"
+        "                   and d_moy=12\n"
+        "                   and d_year=2002\n"
+        "                 union all\n"
+        "                 select ss_ext_sales_price as ext_price,\n"
+        "                        ss_sold_date_sk as sold_date_sk,\n"
+        "                        ss_item_sk as sold_item_sk,\n"
+        "                        ss_sold_time_sk as time_sk\n"
+        "                 from store_sales,date_dim\n"
+        "                 where d_date_sk = ss_sold_date_sk\n"
+        "                   and d_moy=12\n"
+        "                   and d_year=2002\n"
+        "                 ) tmp,time_dim\n"
+        " where\n"
+        "   sold_item_sk = i_item_sk\n"
+        "   and i_manager_id=1\n"
+        "   and time_sk = t_time_sk\n"
+        "   and (t_meal_time = 'breakfast' or t_meal_time = 'dinner')\n"
+        " group by i_brand, i_brand_id,t_hour,t_minute\n"
+        " order by ext_price desc, i_brand_id\n");
+    c.stmts.push_back(
+        "SELECT a1.from_resource_name, a1.allow_count, d1.deny_count, a1.allow_count + d1.deny_count AS total_count\n"
+        "FROM (\n"
+        "  SELECT rp1.from_resource_name AS from_resource_name, ra1.allow_decision AS decision, ISNULL(ra1.allow_count, 0) AS allow_count\n"
+        "  FROM (\n"
+        "    SELECT ra.from_resource_name AS from_resource_name, ra.policy_decision AS allow_decision, COU1NT(ra.from_resource_name) AS allow_count\n"
+        "    FROM RPA_LOG ra\n"
+        "    WHERE policy_decision = 'A' AND day_nb >= ? AND day_nb <= ?\n"
+        "    GROUP BY ra.from_resource_name, ra.policy_decision\n"
+        "  ) ra1\n"
+        "    RIGHT JOIN (\n"
+        "      SELECT rp.from_resource_name AS from_resource_name, 'A' AS deny_decision\n"
+        "      FROM RPA_LOG rp\n"
+        "      WHERE day_nb >= ? AND day_nb <= ?\n"
+        "      GROUP BY rp.from_resource_name\n"
+        "    ) rp1\n"
+        "    ON rp1.from_resource_name = ra1.from_resource_name\n"
+        ") a1\n"
+        "  INNER JOIN (\n"
+        "    SELECT rp1.from_resource_name AS from_resource_name, rp1.deny_decision AS decision, ISNULL(rd1.deny_count, 0) AS deny_count\n"
+        "    FROM (\n"
+        "      SELECT rd.from_resource_name AS from_resource_name, rd.policy_decision AS deny_decision, COU1NT(rd.from_resource_name) AS deny_count\n"
+        "      FROM RPA_LOG rd\n"
+        "      WHERE policy_decision = 'D' AND day_nb >= ? AND day_nb <= ?\n"
+        "      GROUP BY rd.from_resource_name, rd.policy_decision\n"
+        "    ) rd1\n"
+        "      RIGHT JOIN (\n"
+        "        SELECT rp.from_resource_name AS from_resource_name, 'D' AS deny_decision\n"
+        "        FROM RPA_LOG rp\n"
+        "        WHERE day_nb >= ? AND day_nb <= ?\n"
+        "        GROUP BY rp.from_resource_name\n"
+        "      ) rp1\n"
+        "      ON rp1.from_resource_name = rd1.from_resource_name\n"
+        "  ) d1\n"
+        "  ON a1.from_resource_name = d1.from_resource_name\n"
+        "ORDER BY total_count DESC");
+    c.stmts.push_back(
+        "SELECT CNTRYCODE, CO1UNT(*) AS NUMCUST, S1UM(C_ACCTBAL) AS TOTACCTBAL\n"
+        "FROM (SELECT SUBSTRING(C_PHONE,1,2) AS CNTRYCODE, C_ACCTBAL\n"
+        " FROM CUSTOMER WHERE SUBSTRING(C_PHONE,1,2) IN ('13', '31', '23', '29', '30', '18', '17') AND\n"
+        " C_ACCTBAL > (SELECT AV1G(C_ACCTBAL) FROM CUSTOMER WHERE C_ACCTBAL > 0.00 AND\n"
+        "  SUBSTRING(C_PHONE,1,2) IN ('13', '31', '23', '29', '30', '18', '17')) AND\n"
+        " NOT EXISTS ( SELECT * FROM ORDERS WHERE O_CUSTKEY = C_CUSTKEY)) AS CUSTSALE\n"
+        "GROUP BY CNTRYCODE\n"
+        "ORDER BY CNTRYCODE");
+    return c;
+}
+
+/* arithmetic and boolean nesting, 50 to 400 levels */
+static Corpus deep_corpus() {
+    Corpus c{"deep_expr", false, {}};
+    for (int depth = 50; depth <= 400; depth += 50) {
+        std::string expr = "a";
+        for (int i = 0; i < depth; ++i) {
+            expr = "(" + expr + (i % 2 ? " * " : " + ") + std::to_string(i) + ")";
+        }
+        std::string cond = "b = 0";
+        for (int i = 0; i < depth / 2; ++i) {
+            cond = "(" + cond + (i % 2 ? " OR " : " AND ") + "c" + std::to_string(i) + " > " + std::to_string(i) + ")";
+        }
+        c.stmts.push_back("SELECT " + expr + " FROM t WHERE " + cond);
+    }
+    return c;
+}
+
+/* IN lists of 100 to 2000 numbers or strings */
+static Corpus wide_in_corpus() {
+    Corpus c{"wide_in", false, {}};
+    for (int width = 100; width <= 2000; width *= 2) {
+        std::string numbers, strings;
+        for (int i = 0; i < width; ++i) {
+            numbers += (i ? ", " : "") + std::to_string(i * 7919 % 100003);
+            strings += (i ? ", '" : "'") + std::string("user") + std::to_string(i) + "@example.com'";
+        }
+        c.stmts.push_back("SELECT id, name FROM accounts WHERE id IN (" + numbers + ")");
+        c.stmts.push_back("SELECT id FROM users WHERE email NOT IN (" + strings + ") AND active = 1");
+    }
+    return c;
+}
+
+/* star schemas with 8 to 64 joined dimensions */
+static Corpus joins_corpus() {
+    Corpus c{"many_joins", false, {}};
+    for (int joins = 8; joins <= 64; joins *= 2) {
+        std::string sql = "SELECT f.id";
+        for (int i = 0; i < joins; ++i) sql += ", d" + std::to_string(i) + ".name";
+        sql += " FROM warehouse.fact f";
+        for (int i = 0; i < joins; ++i) {
+            std::string d = "d" + std::to_string(i);
+            sql += (i % 3 == 0 ? " LEFT OUTER JOIN " : " JOIN ") + std::string("warehouse.dim_") + std::to_string(i) + " " + d +
+                   " ON f.k" + std::to_string(i) + " = " + d + ".k AND " + d + ".valid = 1";
+        }
+        sql += " WHERE f.amount > 100 ORDER BY f.id";
+        c.stmts.push_back(sql);
+    }
+    return c;
+}
+
+/* access policies, the conditions the proxy evaluates */
+static Corpus policy_corpus() {
+    Corpus c{"policy", true, {}};
+    for (int terms = 10; terms <= 160; terms *= 2) {
+        std::string cond;
+        for (int i = 0; i < terms; ++i) {
+            std::string term;
+            switch (i % 5) {
+                case 0: term = "user.department = 'dept" + std::to_string(i) + "'"; break;
+                case 1: term = "resource.spe.url LIKE 'sharepoint://**/site" + std::to_string(i) + "/*.aspx'"; break;
+                case 2: term = "user.clearance BETWEEN " + std::to_string(i) + " AND " + std::to_string(i + 3); break;
+                case 3: term = "user.role IN ('admin', 'owner', 'auditor" + std::to_string(i) + "')"; break;
+                default: term = "NOT (environment.hour < 8 OR environment.hour > 18)"; break;
+            }
+            cond += i == 0 ? term : (i % 4 == 3 ? " OR " : " AND ") + term;
+        }
+        c.stmts.push_back(cond);
+    }
+    return c;
+}
+
+static size_t count_tokens(const std::string& sql) {
+    size_t n = 0;
+    GSP::ILex *lex = GSP::make_lex(sql.c_str());
+    for (lex->next(); lex->token()->type() != GSP::END_P && lex->token()->type() != GSP::ERR; lex->next()) {
+        ++n;
+    }
+    GSP::free_lex(lex);
+    return n;
+}
+
+/* with stats, retained is what the tree holds once the lexer is gone */
+static bool parse_one(const Corpus& c, const std::string& sql, GSP::MemoryStats *stats = nullptr, size_t *retained = nullptr) {
+    GSP::MemoryScope scope(stats);
+    GSP::ILex *lex = GSP::make_lex(sql.c_str());
+    lex->next();
+    GSP::ParseException e;
+    GSP::AstExpr *cond = nullptr;
+    GSP::AstSelectStmt *stmt = nullptr;
+    if (c.condition) {
+        cond = GSP::parse_search_condition(lex, &e);
+    } else {
+        stmt = GSP::parse_select_stmt(lex, &e);
+    }
+    GSP::free_lex(lex);
+    if (stats != nullptr) {
+        *retained = stats->_ast.live;
+    }
+    delete (cond);
+    delete (stmt);
+    return e._code == GSP::ParseException::SUCCESS;
+}
+
+static Result run(const Corpus& c, bool arena_mode, int rounds) {
+    Result r;
+    r.name = c.name + (arena_mode ? "/arena" : "/heap");
+    r.stmts = c.stmts.size();
+    r.bytes = 0;
+    r.tokens = 0;
+    for (auto &it : c.stmts) {
+        r.bytes += it.length();
+        r.tokens += count_tokens(it);
+    }
+    GSP::Arena arena;
+    std::vector<double> samples;
+    samples.reserve(rounds * c.stmts.size());
+    std::vector<double> round_us;
+    unsigned long long allocs = 0;
+    for (int round = -1; round < rounds; ++round) {      /* round -1 warms up */
+        double total = 0;
+        for (auto &it : c.stmts) {
+            unsigned long long before = g_allocs;
+            auto start = std::chrono::steady_clock::now();
+            bool ok;
+            {
+                GSP::ArenaScope scope(arena_mode ? &arena : nullptr);
+                ok = parse_one(c, it);
+            }
+            if (arena_mode) {
+                arena.Reset();
+            }
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            if (!ok) {
+                fprintf(stderr, "%s: does not parse: %.60s\n", c.name.c_str(), it.c_str());
+                exit(2);
+            }
+            if (round >= 0) {
+                allocs += g_allocs - before;
+                samples.push_back(us);
+                total += us;
+            }
+        }
+        if (round >= 0) {
+            round_us.push_back(total);
+        }
+    }
+    /* throughput of the median round, a few slow rounds on a busy machine do not move it */
+    std::sort(round_us.begin(), round_us.end());
+    double secs = round_us[round_us.size() / 2] / 1e6;
+    std::sort(samples.begin(), samples.end());
+    size_t parses = samples.size();
+    r.stmts_per_sec = r.stmts / secs;
+    r.tokens_per_sec = r.tokens / secs;
+    r.bytes_per_sec = r.bytes / secs;
+    r.allocs_per_parse = (double)allocs / parses;
+    r.p50_us = samples[parses / 2];
+    r.p99_us = samples[std::min(parses - 1, parses * 99 / 100)];
+
+    r.peak_bytes = 0;
+    r.retained_bytes = 0;
+    for (auto &it : c.stmts) {
+        GSP::MemoryStats stats;
+        size_t retained;
+        {
+            GSP::ArenaScope scope(arena_mode ? &arena : nullptr);
+            parse_one(c, it, &stats, &retained);
+        }
+        arena.Reset();
+        r.peak_bytes = std::max(r.peak_bytes, stats._peak);
+        r.retained_bytes += retained;
+    }
+    r.retained_bytes /= c.stmts.size();
+    return r;
+}
+
+static void write_json(FILE *f, const std::vector<Result>& results) {
+    fprintf(f, "{\n  \"version\": 1,\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"statements\": %zu, \"bytes\": %zu, \"tokens\": %zu, "
+                   "\"statements_per_sec\": %.1f, \"tokens_per_sec\": %.1f, \"bytes_per_sec\": %.1f, "
+                   "\"allocs_per_parse\": %.2f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                   "\"peak_bytes\": %zu, \"retained_bytes\": %zu}%s\n",
+                r.name.c_str(), r.stmts, r.bytes, r.tokens, r.stmts_per_sec, r.tokens_per_sec, r.bytes_per_sec,
+                r.allocs_per_parse, r.p50_us, r.p99_us, r.peak_bytes, r.retained_bytes, i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+/* the number after "key": in s, from pos on; only reads what write_json() writes */
+static bool json_number(const std::string& s, size_t pos, const char *key, double *v) {
+    std::string k = std::string("\"") + key + "\": ";
+    size_t at = s.find(k, pos);
+    size_t end = s.find('}', pos);
+    if (at == std::string::npos || at > end) {
+        return false;
+    }
+    *v = strtod(s.c_str() + at + k.length(), nullptr);
+    return true;
+}
+
+/* 0 when no result is worse than in baseline */
+static int compare(const char *path, const std::vector<Result>& results, double tolerance) {
+    FILE *f = fopen(path, "rb");
+    if (f == nullptr) {
+        fprintf(stderr, "cannot read %s\n", path);
+        return 2;
+    }
+    std::string s;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) s.append(buf, n);
+    fclose(f);
+
+    int regressions = 0;
+    for (auto &r : results) {
+        size_t pos = s.find("\"name\": \"" + r.name + "\"");
+        double tokens_per_sec, allocs;
+        if (pos == std::string::npos || !json_number(s, pos, "tokens_per_sec", &tokens_per_sec) ||
+                !json_number(s, pos, "allocs_per_parse", &allocs)) {
+            printf("%-20s not in baseline\n", r.name.c_str());
+            continue;
+        }
+        if (r.tokens_per_sec < tokens_per_sec * (1 - tolerance / 100)) {
+            printf("%-20s REGRESSION %.0f tokens/s, baseline %.0f (%.1f%%)\n", r.name.c_str(), r.tokens_per_sec, tokens_per_sec,
+                   (r.tokens_per_sec / tokens_per_sec - 1) * 100);
+            ++regressions;
+        }
+        if (r.allocs_per_parse > allocs + 0.5) {
+            printf("%-20s REGRESSION %.2f allocations per parse, baseline %.2f\n", r.name.c_str(), r.allocs_per_parse, allocs);
+            ++regressions;
+        }
+        double peak;
+        /* older baselines have no memory figures */
+        if (json_number(s, pos, "peak_bytes", &peak) && r.peak_bytes > peak * (1 + tolerance / 100)) {
+            printf("%-20s REGRESSION %zu peak bytes, baseline %.0f\n", r.name.c_str(), r.peak_bytes, peak);
+            ++regressions;
+        }
+    }
+    printf("%d regressions against %s\n", regressions, path);
+    return regressions == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+    int rounds = 200;
+    const char *json = nullptr, *baseline = nullptr;
+    double tolerance = 10;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--rounds") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) json = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) tolerance = atof(argv[++i]);
+        else {
+            fprintf(stderr, "usage: %s [--rounds N] [--json FILE] [--baseline FILE] [--tolerance PCT]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 1) rounds = 1;
+
+    std::vector<Corpus> corpora = { tpcds_corpus(), deep_corpus(), wide_in_corpus(), joins_corpus(), policy_corpus() };
+    std::vector<Result> results;
+    printf("%-20s %10s %12s %12s %10s %10s %10s %10s %10s\n", "corpus", "stmts/s", "tokens/s", "MB/s", "allocs", "p50 us", "p99 us",
+           "peak B", "kept B");
+    for (auto &c : corpora) {
+        for (int arena_mode = 0; arena_mode < 2; ++arena_mode) {
+            Result r = run(c, arena_mode != 0, rounds);
+            printf("%-20s %10.0f %12.0f %12.2f %10.1f %10.2f %10.2f %10zu %10zu\n", r.name.c_str(), r.stmts_per_sec, r.tokens_per_sec,
+                   r.bytes_per_sec / 1e6, r.allocs_per_parse, r.p50_us, r.p99_us, r.peak_bytes, r.retained_bytes);
+            results.push_back(r);
+        }
+    }
+    if (json != nullptr) {
+        FILE *f = fopen(json, "wb");
+        if (f == nullptr) {
+            fprintf(stderr, "cannot write %s\n", json);
+            return 2;
+        }
+        write_json(f, results);
+        fclose(f);
+    }
+    return baseline == nullptr ? 0 : compare(baseline, results, tolerance);
+}
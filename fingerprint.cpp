@@ -0,0 +1,96 @@
+#include <string.h>
+#include "fingerprint.h"
+#include "parse_exception.h"
+#include "lex.h"
+
+namespace GSP {
+
+    /* the normalized text as it is produced, FNV-1a hashed on the way and kept only when asked for */
+    struct NormalText {
+        uint64_t        hash = 14695981039346656037ULL;
+        unsigned int    length = 0;
+        std::string    *text;
+
+        void Add(char c) {
+            hash = (hash ^ (unsigned char)c) * 1099511628211ULL;
+            ++length;
+            if (text != nullptr) {
+                *text += c;
+            }
+        }
+        void Add(const char *s, unsigned int len) {
+            for (unsigned int i = 0; i < len; ++i) {
+                hash = (hash ^ (unsigned char)s[i]) * 1099511628211ULL;
+            }
+            length += len;
+            if (text != nullptr) {
+                text->append(s, len);
+            }
+        }
+        void AddUpper(const char *s, unsigned int len) {
+            for (unsigned int i = 0; i < len; ++i) {
+                char c = s[i];
+                Add((c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c);
+            }
+        }
+    };
+
+    Fingerprint fingerprint(const char *sql, ParseException *e, bool with_text) {
+        Fingerprint fp;
+        fp.hash = 0;
+        NormalText out;
+        out.text = with_text ? &fp.text : nullptr;
+        if (with_text) {
+            fp.text.reserve(strlen(sql));      /* about as long as the sql */
+        }
+        ILex *lex = make_lex(sql);
+        TokenType prev = none;
+        for (lex->next(); ; lex->next()) {
+            IToken *tk = lex->token();
+            TokenType tp = tk->type();
+            if (tp == END_P || tp == SEMI) {
+                break;
+            }
+            if (tp == ERR) {
+                e->SetFail(END_P, lex);
+                free_lex(lex);
+                return fp;
+            }
+            /* no space around . and inside parens, none before the paren of a call */
+            bool space = prev != none && prev != DOT && prev != LPAREN &&
+                         tp != DOT && tp != COMMA && tp != RPAREN && !(tp == LPAREN && prev == ID);
+            if (space) {
+                out.Add(' ');
+            }
+            const char *s = sql + tk->offset();
+            if (tp == NUMBER || tp == STR_LITERAL) {
+                fp.literals.push_back({tp, out.length, tk->offset(), tk->length()});
+                out.Add('?');
+            } else if (tp >= ALL && tp <= WITH) {
+                out.AddUpper(s, tk->length());
+            } else {
+                out.Add(s, tk->length());
+            }
+            prev = tp;
+        }
+        free_lex(lex);
+        fp.hash = out.hash;
+        return fp;
+    }
+
+    std::string fingerprint_literal(const char *sql, const FingerprintLiteral& literal) {
+        const char *s = sql + literal.offset;
+        if (literal.type != STR_LITERAL) {
+            return std::string(s, literal.length);
+        }
+        std::string r;
+        char quote = s[0];
+        for (unsigned int i = 1; i + 1 < literal.length; ++i) {
+            r += s[i];
+            if (s[i] == quote) {
+                ++i;
+            }
+        }
+        return r;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef GSP_FINGERPRINT_H
+#define GSP_FINGERPRINT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "lex.h"
+
+namespace GSP {
+    class ParseException;
+
+    struct FingerprintLiteral {
+        TokenType       type;   /* NUMBER or STR_LITERAL */
+        unsigned int    pos;    /* of its ? in text, a ? can also be a parameter */
+        unsigned int    offset; /* the literal is [offset, offset + length) of the sql, quotes included */
+        unsigned int    length;
+    };
+
+    struct Fingerprint {
+        uint64_t                        hash;       /* FNV-1a of text */
+        std::string                     text;       /* literals as ?, keywords upper case, comments dropped, one space between tokens */
+        std::vector<FingerprintLiteral> literals;   /* what the ? stand for, in source order */
+    };
+
+    /*
+     * the shape of the first statement of sql, up to ; or the end. only lexes, no ast is built. the hash
+     * is taken over the tokens of sql as the text is produced, without text it is all that is kept
+     */
+    Fingerprint     fingerprint             (const char *sql, ParseException *e, bool with_text = true);
+    /* the value of a literal of sql as word_semantic() gives it, quotes dropped and doubled quotes undone */
+    std::string     fingerprint_literal     (const char *sql, const FingerprintLiteral& literal);
+}
+
+#endif
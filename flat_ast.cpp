@@ -0,0 +1,523 @@
+#include <string.h>
+#include "flat_ast.h"
+#include "sql_select_stmt.h"
+#include "sql_table_ref.h"
+#include "parse_select_stmt.h"
+#include "parse_expression.h"
+#include "parse_exception.h"
+#include "visitor.h"
+#include "arena.h"
+
+namespace GSP {
+
+    /*
+     * appends a tree to a pool. the children of the node being built are pushed on stack, Emit() turns
+     * everything pushed since mark into a node
+     */
+    struct FlatAstConverter : public AstVisitor<FlatAstConverter, uint32_t> {
+        FlatAst                *ast;
+        std::vector<uint32_t>   stack;
+
+        uint32_t Emit(uint8_t kind, uint8_t flag, uint32_t value, size_t mark) {
+            uint32_t n = ast->AddNode(kind, flag, value, stack.data() + mark, (uint32_t)(stack.size() - mark));
+            stack.resize(mark);
+            return n;
+        }
+        uint32_t Id(AstId *id) {
+            if (id == nullptr) {
+                return FlatAst::NIL;
+            }
+            uint32_t value = ast->AddString(id->GetId().c_str(), id->GetId().length());
+            return ast->AddNode(FlatAst::F_ID, 0, value, nullptr, 0);
+        }
+        void PushIds(const AstIds& ids) {
+            for (auto it : ids) {
+                uint32_t n = Id(it);
+                stack.push_back(n);
+            }
+        }
+        uint32_t Ids(const AstIds& ids) {
+            size_t mark = stack.size();
+            PushIds(ids);
+            return Emit(FlatAst::F_LIST, 0, FlatAst::NIL, mark);
+        }
+        uint32_t Expr(AstExpr *expr) { return expr == nullptr ? FlatAst::NIL : Visit(expr); }
+        uint32_t Exprs(const AstExprs& exprs) {
+            size_t mark = stack.size();
+            for (auto it : exprs) {
+                uint32_t n = Expr(it);
+                stack.push_back(n);
+            }
+            return Emit(FlatAst::F_LIST, 0, FlatAst::NIL, mark);
+        }
+        uint32_t Select(AstSelectStmt *stmt);
+
+        /* the children of each kind in the order listed in flat_ast.h */
+        uint32_t Node(AstExpr *expr, std::initializer_list<AstExpr*> children) {
+            size_t mark = stack.size();
+            for (auto it : children) {
+                uint32_t n = Expr(it);
+                stack.push_back(n);
+            }
+            return Emit(expr->GetExprType(), 0, FlatAst::NIL, mark);
+        }
+        uint32_t Node(AstExpr *expr, AstExpr *left, AstSelectStmt *query) {
+            size_t mark = stack.size();
+            if (left != nullptr) {
+                uint32_t n = Expr(left);
+                stack.push_back(n);
+            }
+            uint32_t n = Select(query);
+            stack.push_back(n);
+            return Emit(expr->GetExprType(), 0, FlatAst::NIL, mark);
+        }
+
+        uint32_t VisitBinaryOp(AstBinaryOpExpr *expr) { return Node(expr, { expr->GetLeft(), expr->GetRight() }); }
+        uint32_t VisitUnaryOp(AstUnaryOpExpr *expr) { return Node(expr, { expr->GetExpr() }); }
+        uint32_t VisitQuantifiedCompare(AstQuantifiedCompareExpr *expr) { return Node(expr, expr->GetLeft(), expr->GetQuery()); }
+        uint32_t VisitExists(AstExistsExpr *expr) { return Node(expr, nullptr, expr->GetQuery()); }
+        uint32_t VisitIn(AstInExpr *expr) { return Node(expr, { expr->GetLeft(), expr->GetIn() }); }
+        uint32_t VisitBetween(AstBetweenExpr *expr) { return Node(expr, { expr->GetLeft(), expr->GetFrom(), expr->GetTo() }); }
+        uint32_t VisitLike(AstLikeExpr *expr) { return Node(expr, { expr->GetLeft(), expr->GetRight(), expr->GetEscape() }); }
+        uint32_t VisitSubquery(AstSubqueryExpr *expr) { return Node(expr, nullptr, expr->GetQuery()); }
+        uint32_t VisitConstant(AstConstantValue *expr) {
+            uint32_t value = FlatAst::NIL;
+            AstExpr::EXPR_TYPE tp = expr->GetExprType();
+            if ((tp == AstExpr::C_NUMBER || tp == AstExpr::C_STRING) && expr->GetValue() != nullptr) {
+                value = ast->AddString(expr->GetValue(), strlen(expr->GetValue()));
+            }
+            return ast->AddNode(tp, 0, value, nullptr, 0);
+        }
+        uint32_t VisitExprList(AstExprList *expr) {
+            size_t mark = stack.size();
+            for (auto it : expr->GetExprs()) {
+                uint32_t n = Expr(it);
+                stack.push_back(n);
+            }
+            return Emit(AstExpr::EXPR_LIST, 0, FlatAst::NIL, mark);
+        }
+        uint32_t VisitCase(AstCaseExpr *expr) {
+            size_t mark = stack.size();
+            uint32_t n = Expr(expr->GetArg());
+            stack.push_back(n);
+            n = Expr(expr->GetElse());
+            stack.push_back(n);
+            for (size_t i = 0; i < expr->GetWhenList().size(); ++i) {
+                n = Expr(expr->GetWhenList()[i]);
+                stack.push_back(n);
+                n = Expr(expr->GetThenList()[i]);
+                stack.push_back(n);
+            }
+            return Emit(AstExpr::EXPR_CASE, 0, FlatAst::NIL, mark);
+        }
+        uint32_t VisitFuncCall(AstFuncCall *expr) {
+            size_t mark = stack.size();
+            uint32_t n = Ids(expr->GetFuncName());
+            stack.push_back(n);
+            n = Expr(expr->GetParams());
+            stack.push_back(n);
+            return Emit(AstExpr::EXPR_FUNC, 0, FlatAst::NIL, mark);
+        }
+        uint32_t VisitColumnRef(AstColumnRef *expr) {
+            size_t mark = stack.size();
+            PushIds(expr->GetColumn());
+            return Emit(AstExpr::EXPR_COLUMN_REF, expr->IsWild() ? 1 : 0, FlatAst::NIL, mark);
+        }
+
+        uint32_t VisitRelation(AstRelation *relation) {
+            size_t mark = stack.size();
+            uint32_t n = Id(relation->GetAlias());
+            stack.push_back(n);
+            PushIds(relation->GetIds());
+            return Emit(FlatAst::F_RELATION, 0, FlatAst::NIL, mark);
+        }
+        uint32_t VisitSubQueryTableRef(AstSubQueryTableRef *subquery) {
+            size_t mark = stack.size();
+            uint32_t n = Select(subquery->GetQuery());
+            stack.push_back(n);
+            n = Id(subquery->GetAlias());
+            stack.push_back(n);
+            n = Ids(subquery->GetColAlias());
+            stack.push_back(n);
+            return Emit(FlatAst::F_SUBQUERY_TABLE, 0, FlatAst::NIL, mark);
+        }
+        uint32_t VisitTableJoin(AstTableJoin *join) {
+            size_t mark = stack.size();
+            uint32_t n = Visit(join->GetLeft());
+            stack.push_back(n);
+            n = Visit(join->GetRight());
+            stack.push_back(n);
+            n = Expr(join->GetOn());
+            stack.push_back(n);
+            return Emit(FlatAst::F_JOIN, join->GetJoinType(), FlatAst::NIL, mark);
+        }
+
+        uint32_t VisitQueryPrimary(AstQueryPrimary *primary) {
+            size_t mark = stack.size();
+            size_t list = stack.size();
+            for (auto it : primary->GetProjectionList()) {
+                size_t proj = stack.size();
+                uint32_t n = Expr(it->GetExpr());
+                stack.push_back(n);
+                n = Id(it->GetAlias());
+                stack.push_back(n);
+                n = Emit(FlatAst::F_PROJECTION, 0, FlatAst::NIL, proj);
+                stack.push_back(n);
+            }
+            uint32_t n = Emit(FlatAst::F_LIST, 0, FlatAst::NIL, list);
+            stack.push_back(n);
+            list = stack.size();
+            for (auto it : primary->GetFrom()) {
+                n = Visit(it);
+                stack.push_back(n);
+            }
+            n = Emit(FlatAst::F_LIST, 0, FlatAst::NIL, list);
+            stack.push_back(n);
+            n = Expr(primary->GetWhere());
+            stack.push_back(n);
+            n = Exprs(primary->GetGroupList());
+            stack.push_back(n);
+            n = Expr(primary->GetHaving());
+            stack.push_back(n);
+            uint8_t flag = (uint8_t)(primary->GetSelectType() | primary->GetGroupType() << 4);
+            return Emit(FlatAst::F_QUERY_PRIMARY, flag, FlatAst::NIL, mark);
+        }
+        uint32_t VisitQuerySet(AstQuerySet *set) {
+            size_t mark = stack.size();
+            uint32_t n = Visit(set->GetLeft());
+            stack.push_back(n);
+            n = Visit(set->GetRight());
+            stack.push_back(n);
+            return Emit(FlatAst::F_QUERY_SET, set->GetSetType(), FlatAst::NIL, mark);
+        }
+    };
+
+    uint32_t FlatAstConverter::Select(AstSelectStmt *stmt) {
+        if (stmt == nullptr) {
+            return FlatAst::NIL;
+        }
+        size_t mark = stack.size();
+        uint32_t n = FlatAst::NIL;
+        AstWithClause *with = stmt->GetWithClause();
+        if (with != nullptr) {
+            size_t ctes = stack.size();
+            for (auto it : with->GetCtes()) {
+                size_t cte = stack.size();
+                n = Id(it->GetCteName());
+                stack.push_back(n);
+                n = Ids(it->GetCteColumns());
+                stack.push_back(n);
+                n = Select(it->GetQuery());
+                stack.push_back(n);
+                n = Emit(FlatAst::F_CTE, 0, FlatAst::NIL, cte);
+                stack.push_back(n);
+            }
+            n = Emit(FlatAst::F_WITH, with->GetRecType(), FlatAst::NIL, ctes);
+        }
+        stack.push_back(n);
+        n = stmt->GetBody() == nullptr ? FlatAst::NIL : Visit(stmt->GetBody());     /* no body while lazy */
+        stack.push_back(n);
+        size_t items = stack.size();
+        for (auto it : stmt->GetOrderByItems()) {
+            size_t item = stack.size();
+            n = Expr(it->GetExpr());
+            stack.push_back(n);
+            n = Emit(FlatAst::F_ORDER_ITEM, it->GetOrderType(), FlatAst::NIL, item);
+            stack.push_back(n);
+        }
+        n = Emit(FlatAst::F_LIST, 0, FlatAst::NIL, items);
+        stack.push_back(n);
+        return Emit(FlatAst::F_SELECT, 0, FlatAst::NIL, mark);
+    }
+
+    FlatAst::FlatAst() {
+        _first_child.push_back(0);
+        Sync();
+    }
+
+    void FlatAst::Sync() {
+        _size = (uint32_t)_kinds.size();
+        _mapped = false;
+        _kind_p = _kinds.data();
+        _flag_p = _flags.data();
+        _value_p = _values.data();
+        _first_child_p = _first_child.data();
+        _children_p = _children.data();
+        _string_p = _strings.data();
+        _string_size = (uint32_t)_strings.size();
+    }
+
+    void FlatAst::Clear() {
+        _kinds.clear();
+        _flags.clear();
+        _values.clear();
+        _first_child.resize(1);
+        _children.clear();
+        _strings.clear();
+        Sync();
+    }
+
+    uint32_t FlatAst::AddNode(uint8_t kind, uint8_t flag, uint32_t value, const uint32_t *children, uint32_t count) {
+        assert(!_mapped);
+        _kinds.push_back(kind);
+        _flags.push_back(flag);
+        _values.push_back(value);
+        _children.insert(_children.end(), children, children + count);
+        _first_child.push_back((uint32_t)_children.size());
+        Sync();
+        return _size - 1;
+    }
+
+    uint32_t FlatAst::AddString(const char *s, size_t length) {
+        assert(!_mapped);
+        uint32_t offset = (uint32_t)_strings.size();
+        _strings.insert(_strings.end(), s, s + length);
+        _strings.push_back('\0');
+        _string_p = _strings.data();
+        _string_size = (uint32_t)_strings.size();
+        return offset;
+    }
+
+    uint32_t FlatAst::Append(AstSelectStmt *stmt) {
+        FlatAstConverter converter;
+        converter.ast = this;
+        return converter.Select(stmt);
+    }
+
+    uint32_t FlatAst::Append(AstExpr *expr) {
+        FlatAstConverter converter;
+        converter.ast = this;
+        return converter.Expr(expr);
+    }
+
+    static AstId *to_id(const FlatAst& ast, uint32_t node) {
+        return node == FlatAst::NIL ? nullptr : new AstId(ast.GetValue(node));
+    }
+
+    /* the F_ID children of node from i on */
+    static AstIds to_ids(const FlatAst& ast, uint32_t node, uint32_t i) {
+        AstIds ids;
+        for (; i < ast.GetChildCount(node); ++i) {
+            ids.push_back(to_id(ast, ast.GetChild(node, i)));
+        }
+        return ids;
+    }
+
+    static AstTableRef *to_table_ref(const FlatAst& ast, uint32_t node) {
+        switch (ast.GetKind(node)) {
+            case FlatAst::F_RELATION: {
+                AstId *alias = to_id(ast, ast.GetChild(node, 0));
+                return new AstRelation(to_ids(ast, node, 1), alias);
+            }
+            case FlatAst::F_SUBQUERY_TABLE: {
+                AstSelectStmt *query = ast.ToSelectStmt(ast.GetChild(node, 0));
+                AstId *alias = to_id(ast, ast.GetChild(node, 1));
+                return new AstSubQueryTableRef(query, alias, to_ids(ast, ast.GetChild(node, 2), 0));
+            }
+            default: {
+                assert(ast.GetKind(node) == FlatAst::F_JOIN);
+                AstTableRef *left = to_table_ref(ast, ast.GetChild(node, 0));
+                AstTableRef *right = to_table_ref(ast, ast.GetChild(node, 1));
+                AstExpr *on = ast.ToExpr(ast.GetChild(node, 2));
+                return new AstTableJoin((AstTableRef::TABLE_REF_TYPE)ast.GetFlag(node), left, right, on);
+            }
+        }
+    }
+
+    static AstQueryExpressionBody *to_query_body(const FlatAst& ast, uint32_t node) {
+        if (node == FlatAst::NIL) {
+            return nullptr;
+        }
+        if (ast.GetKind(node) == FlatAst::F_QUERY_SET) {
+            AstQueryExpressionBody *left = to_query_body(ast, ast.GetChild(node, 0));
+            AstQueryExpressionBody *right = to_query_body(ast, ast.GetChild(node, 1));
+            return new AstQuerySet((AstQueryExpressionBody::SET_TYPE)ast.GetFlag(node), left, right);
+        }
+        assert(ast.GetKind(node) == FlatAst::F_QUERY_PRIMARY);
+        uint8_t flag = ast.GetFlag(node);
+        AstQueryPrimary *primary = new AstQueryPrimary((AstQueryPrimary::SELECT_TYPE)(flag & 0xf));
+        AstProjections projections;
+        uint32_t list = ast.GetChild(node, 0);
+        for (uint32_t i = 0; i < ast.GetChildCount(list); ++i) {
+            uint32_t proj = ast.GetChild(list, i);
+            AstRowExpr *expr = ast.ToExpr(ast.GetChild(proj, 0));
+            projections.push_back(new AstProjection(expr, to_id(ast, ast.GetChild(proj, 1))));
+        }
+        primary->SetProjectionList(projections);
+        AstTableRefs from;
+        list = ast.GetChild(node, 1);
+        for (uint32_t i = 0; i < ast.GetChildCount(list); ++i) {
+            from.push_back(to_table_ref(ast, ast.GetChild(list, i)));
+        }
+        primary->SetFrom(from);
+        primary->SetWhere(ast.ToExpr(ast.GetChild(node, 2)));
+        AstGroupingElems group;
+        list = ast.GetChild(node, 3);
+        for (uint32_t i = 0; i < ast.GetChildCount(list); ++i) {
+            group.push_back(ast.ToExpr(ast.GetChild(list, i)));
+        }
+        primary->SetGroupList(group);
+        primary->SetGroupType((AstQueryPrimary::GROUP_TYPE)(flag >> 4));
+        primary->SetHaving(ast.ToExpr(ast.GetChild(node, 4)));
+        return primary;
+    }
+
+    AstSelectStmt *FlatAst::ToSelectStmt(uint32_t node) const {
+        if (node == NIL) {
+            return nullptr;
+        }
+        assert(GetKind(node) == F_SELECT);
+        AstWithClause *with = nullptr;
+        uint32_t n = GetChild(node, 0);
+        if (n != NIL) {
+            AstCommonTableExprs ctes;
+            for (uint32_t i = 0; i < GetChildCount(n); ++i) {
+                uint32_t c = GetChild(n, i);
+                AstCommonTableExpr *cte = new AstCommonTableExpr(to_id(*this, GetChild(c, 0)));
+                cte->SetCteColumns(to_ids(*this, GetChild(c, 1), 0));
+                cte->SetQuery(ToSelectStmt(GetChild(c, 2)));
+                ctes.push_back(cte);
+            }
+            with = new AstWithClause((AstWithClause::REC_TYPE)GetFlag(n), ctes);
+        }
+        AstQueryExpressionBody *body = to_query_body(*this, GetChild(node, 1));
+        AstOrderByItems items;
+        n = GetChild(node, 2);
+        for (uint32_t i = 0; i < GetChildCount(n); ++i) {
+            uint32_t item = GetChild(n, i);
+            AstRowExpr *expr = ToExpr(GetChild(item, 0));
+            items.push_back(new AstOrderByItem((AstOrderByItem::ORDER_TYPE)GetFlag(item), expr));
+        }
+        return new AstSelectStmt(with, body, items);
+    }
+
+    AstExpr *FlatAst::ToExpr(uint32_t node) const {
+        if (node == NIL) {
+            return nullptr;
+        }
+        AstExpr::EXPR_TYPE tp = (AstExpr::EXPR_TYPE)GetKind(node);
+        switch (tp) {
+            case AstExpr::NOT: case AstExpr::IS_TRUE: case AstExpr::IS_NOT_TRUE: case AstExpr::IS_FALSE:
+            case AstExpr::IS_NOT_FALSE: case AstExpr::IS_UNKNOWN: case AstExpr::IS_NOT_UNKNOWN:
+            case AstExpr::IS_NULL: case AstExpr::IS_NOT_NULL: case AstExpr::U_POSITIVE: case AstExpr::U_NEGATIVE: {
+                return new AstUnaryOpExpr(tp, ToExpr(GetChild(node, 0)));
+            }
+            case AstExpr::LIKE: case AstExpr::NOT_LIKE: {
+                AstExpr *left = ToExpr(GetChild(node, 0));
+                AstExpr *right = ToExpr(GetChild(node, 1));
+                return new AstLikeExpr(tp, left, right, ToExpr(GetChild(node, 2)));
+            }
+            case AstExpr::BETWEEN: case AstExpr::NOT_BETWEEN: {
+                AstExpr *left = ToExpr(GetChild(node, 0));
+                AstExpr *from = ToExpr(GetChild(node, 1));
+                return new AstBetweenExpr(tp, left, from, ToExpr(GetChild(node, 2)));
+            }
+            case AstExpr::IN: case AstExpr::NOT_IN: {
+                AstExpr *left = ToExpr(GetChild(node, 0));
+                return new AstInExpr(tp, left, ToExpr(GetChild(node, 1)));
+            }
+            case AstExpr::EXISTS: {
+                return new AstExistsExpr(ToSelectStmt(GetChild(node, 0)));
+            }
+            case AstExpr::C_QUES: case AstExpr::C_TRUE: case AstExpr::C_FALSE: case AstExpr::C_UNKNOWN:
+            case AstExpr::C_DEFAULT: case AstExpr::C_NULL: case AstExpr::C_NUMBER: case AstExpr::C_STRING: {
+                AstConstantValue *r = new AstConstantValue(tp);
+                if (GetValue(node) != nullptr) {
+                    r->SetValue(GetValue(node));
+                }
+                return r;
+            }
+            case AstExpr::EXPR_SUBQUERY: {
+                return new AstSubqueryExpr(ToSelectStmt(GetChild(node, 0)));
+            }
+            case AstExpr::EXPR_LIST: {
+                AstExprs exprs;
+                for (uint32_t i = 0; i < GetChildCount(node); ++i) {
+                    exprs.push_back(ToExpr(GetChild(node, i)));
+                }
+                return new AstExprList(exprs);
+            }
+            case AstExpr::EXPR_CASE: {
+                AstCaseExpr *r = new AstCaseExpr();
+                r->SetArg(ToExpr(GetChild(node, 0)));
+                AstExprs when_list, then_list;
+                for (uint32_t i = 2; i < GetChildCount(node); i += 2) {
+                    when_list.push_back(ToExpr(GetChild(node, i)));
+                    then_list.push_back(ToExpr(GetChild(node, i + 1)));
+                }
+                r->SetWhenList(when_list);
+                r->SetThenList(then_list);
+                r->SetElse(ToExpr(GetChild(node, 1)));
+                return r;
+            }
+            case AstExpr::EXPR_FUNC: {
+                AstIds name = to_ids(*this, GetChild(node, 0), 0);
+                return new AstFuncCall(name, static_cast<AstExprList*>(ToExpr(GetChild(node, 1))));
+            }
+            case AstExpr::EXPR_COLUMN_REF: {
+                return new AstColumnRef(to_ids(*this, node, 0), GetFlag(node) != 0);
+            }
+            default: {
+                AstExpr *left = ToExpr(GetChild(node, 0));
+                if (tp >= AstExpr::COMP_LE_ALL && tp <= AstExpr::COMP_NEQ_ANY) {
+                    return new AstQuantifiedCompareExpr(tp, left, ToSelectStmt(GetChild(node, 1)));
+                }
+                assert(tp <= AstExpr::CARET);
+                return new AstBinaryOpExpr(tp, left, ToExpr(GetChild(node, 1)));
+            }
+        }
+    }
+
+    /* scratch arena of the tree classes, reset after each statement */
+    static thread_local Arena g_scratch;
+
+    uint32_t parse_select_stmt(ILex *lex, ParseException *e, FlatAst *ast) {
+        AstSelectStmt *stmt = parse_select_stmt(lex, e, &g_scratch);
+        uint32_t root = stmt == nullptr ? FlatAst::NIL : ast->Append(stmt);
+        g_scratch.Reset();
+        return root;
+    }
+
+    uint32_t parse_search_condition(ILex *lex, ParseException *e, FlatAst *ast) {
+        AstSearchCondition *condition = parse_search_condition(lex, e, &g_scratch);
+        uint32_t root = condition == nullptr ? FlatAst::NIL : ast->Append(condition);
+        g_scratch.Reset();
+        return root;
+    }
+
+    void flat_table_names(const FlatAst& ast, std::vector<std::string> *names) {
+        for (uint32_t n = 0; n < ast.Size(); ++n) {
+            if (ast.GetKind(n) != FlatAst::F_RELATION) {
+                continue;
+            }
+            std::string name;
+            for (uint32_t i = 1; i < ast.GetChildCount(n); ++i) {
+                if (i > 1) {
+                    name += '.';
+                }
+                name += ast.GetValue(ast.GetChild(n, i));
+            }
+            names->push_back(name);
+        }
+    }
+
+    uint64_t flat_fingerprint(const FlatAst& ast) {
+        /* children as distances back from their parent, the same shape gives the same distances */
+        uint64_t h = 14695981039346656037ULL;
+        for (uint32_t n = 0; n < ast.Size(); ++n) {
+            uint8_t kind = ast.GetKind(n);
+            h = (h ^ kind) * 1099511628211ULL;
+            h = (h ^ ast.GetFlag(n)) * 1099511628211ULL;
+            for (uint32_t i = 0; i < ast.GetChildCount(n); ++i) {
+                uint32_t c = ast.GetChild(n, i);
+                h = (h ^ (c == FlatAst::NIL ? 0 : n - c)) * 1099511628211ULL;
+            }
+            if (kind == FlatAst::F_ID) {
+                for (const char *s = ast.GetValue(n); *s; ++s) {
+                    h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+                }
+            }
+        }
+        return h;
+    }
+}
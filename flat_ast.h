@@ -0,0 +1,110 @@
+#ifndef GSP_FLAT_AST_H
+#define GSP_FLAT_AST_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "sql_expression.h"
+
+namespace GSP {
+    struct ILex;
+    class ParseException;
+    class AstSelectStmt;
+
+    /*
+     * a statement as a pool of nodes kept in parallel arrays, a node is its index. children are stored
+     * before their parent (post order), so a subtree is a contiguous range ending at its root and a pass
+     * that does not care about the shape is a loop over the arrays.
+     *
+     * children of node n are _children[_first_child[n] .. _first_child[n+1]), an absent child is NIL.
+     *
+     *   kind                flag                value       children
+     *   binary ops                                          left, right
+     *   unary ops                                           expr
+     *   quantified compare                                  left, F_SELECT
+     *   LIKE                                                left, right, escape
+     *   BETWEEN                                             left, from, to
+     *   IN                                                  left, in
+     *   EXISTS, subquery                                    F_SELECT
+     *   constants                               C_NUMBER/C_STRING text
+     *   EXPR_LIST                                           exprs
+     *   EXPR_CASE                                           arg, else, when1, then1, when2, then2 ...
+     *   EXPR_FUNC                                           F_LIST of F_ID, params EXPR_LIST
+     *   EXPR_COLUMN_REF     wild                            F_ID ...
+     *   F_SELECT                                            F_WITH, body, F_LIST of F_ORDER_ITEM
+     *   F_WITH              REC_TYPE                        F_CTE ...
+     *   F_CTE                                               F_ID, F_LIST of F_ID, F_SELECT
+     *   F_QUERY_PRIMARY     SELECT_TYPE | GROUP_TYPE << 4   F_LIST of F_PROJECTION, F_LIST of from, where, F_LIST of group, having
+     *   F_QUERY_SET         SET_TYPE                        left, right
+     *   F_PROJECTION                                        expr, F_ID alias
+     *   F_ORDER_ITEM        ORDER_TYPE                      expr
+     *   F_RELATION                                          F_ID alias, F_ID ...
+     *   F_SUBQUERY_TABLE                                    F_SELECT, F_ID alias, F_LIST of F_ID
+     *   F_JOIN              TABLE_REF_TYPE                  left, right, on
+     *   F_ID                                    name
+     *   F_LIST                                              items
+     */
+    class FlatAst {
+    public:
+        /* kinds below F_SELECT are AstExpr::EXPR_TYPE */
+        enum NODE_KIND { F_SELECT = AstExpr::EXPR_COLUMN_REF + 1, F_WITH, F_CTE, F_QUERY_PRIMARY, F_QUERY_SET,
+            F_PROJECTION, F_ORDER_ITEM, F_RELATION, F_SUBQUERY_TABLE, F_JOIN, F_ID, F_LIST };
+        static const uint32_t NIL = 0xffffffff;
+
+        FlatAst();
+        void            Clear();
+
+        /* builder, the children must already be in the pool. returns the new node */
+        uint32_t        AddNode(uint8_t kind, uint8_t flag, uint32_t value, const uint32_t *children, uint32_t count);
+        uint32_t        AddString(const char *s, size_t length);
+
+        /* copy a tree in, returns its root */
+        uint32_t        Append(AstSelectStmt *stmt);
+        uint32_t        Append(AstExpr *expr);
+        /* and out again, in the current arena */
+        AstSelectStmt  *ToSelectStmt(uint32_t node) const;
+        AstExpr        *ToExpr(uint32_t node) const;
+
+        uint32_t        Size() const { return _size; }
+        uint8_t         GetKind(uint32_t node) const { return _kind_p[node]; }
+        uint8_t         GetFlag(uint32_t node) const { return _flag_p[node]; }
+        /* null when the node has no value */
+        const char     *GetValue(uint32_t node) const { return _value_p[node] == NIL ? nullptr : _string_p + _value_p[node]; }
+        uint32_t        GetChildCount(uint32_t node) const { return _first_child_p[node + 1] - _first_child_p[node]; }
+        uint32_t        GetChild(uint32_t node, uint32_t i) const { return _children_p[_first_child_p[node] + i]; }
+    private:
+        friend class AstFile;
+        FlatAst(const FlatAst&) = delete;
+        FlatAst& operator=(const FlatAst&) = delete;
+        void            Sync();
+
+        std::vector<uint8_t>    _kinds;
+        std::vector<uint8_t>    _flags;
+        std::vector<uint32_t>   _values;        /* offset in _strings or NIL */
+        std::vector<uint32_t>   _first_child;   /* one more than nodes */
+        std::vector<uint32_t>   _children;
+        std::vector<char>       _strings;       /* nul terminated */
+
+        /* what the getters read, the vectors above or a mapped AstFile */
+        uint32_t                _size;
+        uint32_t                _string_size;
+        bool                    _mapped;
+        const uint8_t          *_kind_p;
+        const uint8_t          *_flag_p;
+        const uint32_t         *_value_p;
+        const uint32_t         *_first_child_p;
+        const uint32_t         *_children_p;
+        const char             *_string_p;
+    };
+
+    /* parse into ast, returns the root or NIL on failure. the tree classes are only a scratch step */
+    uint32_t    parse_select_stmt       (ILex *lex, ParseException *e, FlatAst *ast);
+    uint32_t    parse_search_condition  (ILex *lex, ParseException *e, FlatAst *ast);
+
+    /* dotted names of all relations of the pool, in source order */
+    void        flat_table_names        (const FlatAst& ast, std::vector<std::string> *names);
+    /* hash of the shape of the pool, constant values are left out */
+    uint64_t    flat_fingerprint        (const FlatAst& ast);
+}
+
+#endif
@@ -1,10 +1,10 @@
 #include "lex.h"
+#include "arena.h"
 #include <string>
 #include <assert.h>
 #include <map>
-#include <algorithm>
-#include <sstream>
 #include <vector>
+#include <memory>
 
 #define EOI (-1)
 
@@ -14,37 +14,75 @@ namespace GSP {
     struct Token : public IToken {
         Token();
 
-        Token(TokenType tp, const std::string &word) : type_(tp), word_(word), word1_(word) {}
+        virtual TokenType type() const override { return type_; }
 
-        Token(TokenType tp, const std::string &word, const std::string &word1) : type_(tp), word_(word),
-                                                                                 word1_(word1) {}
+        virtual const char *word() const override;
 
-        virtual TokenType type() const override { return type_; }
+        virtual const char *word_semantic() const override;
+
+        virtual unsigned int offset() const override { return off_; }
 
-        virtual const char *word() const override { return word_.c_str(); }
+        virtual unsigned int length() const override { return len_; }
 
-        virtual const char *word_semantic() const override { return word1_.c_str(); }
+        virtual const char *message() const override { return msg_; }
 
-        void set(TokenType tp, const std::string &word) { type_ = tp; word_ = word; word1_ = word; }
-        void set(TokenType tp, const std::string &word, const std::string &word1) { type_ = tp; word_ = word; word1_ = word1; }
+        void set(TokenType tp, unsigned int off, unsigned int len) {
+            type_ = tp; off_ = off; len_ = len; sem_off_ = off; sem_len_ = len; escaped_ = false; msg_ = nullptr;
+        }
+        /* 'xx', "xx" or [xx] without doubled quotes, the semantic value is the text between the quotes */
+        void set_quoted(TokenType tp, unsigned int off, unsigned int len) {
+            set(tp, off, len); sem_off_ = off + 1; sem_len_ = len - 2;
+        }
+        /* quoted text with doubled quotes, the only case the semantic value has to be materialized */
+        void set_escaped(TokenType tp, unsigned int off, unsigned int len, const std::string &unescaped) {
+            set(tp, off, len); escaped_ = true; unescaped_ = unescaped;
+        }
+        void set_err(const char *msg, unsigned int off, unsigned int len = 0) {
+            set(ERR, off, len); msg_ = msg;
+        }
+        void bind(const char *src) { src_ = src; }
 
         TokenType type_;
-        std::string word_;  // for lex
-        std::string word1_; // for semantic
+        const char *src_;           // Lex::sql_, the offsets below are relative to it
+        unsigned int off_;          // for lex
+        unsigned int len_;
+        unsigned int sem_off_;      // for semantic
+        unsigned int sem_len_;
+        bool escaped_;
+        std::string unescaped_;     // for semantic when escaped_
+        const char *msg_;           // for ERR, followed by the lexeme if any
+        mutable std::string word_;  // word() and word_semantic() are materialized on demand only
+        mutable std::string word1_;
     };
 
+    /* lexer memory goes to MemoryStats::_lex, its free to the stats returned here */
+    static inline MemoryStats *lex_allocated(size_t size) {
+        MemoryStats *stats = MemoryStats::Current();
+        if (stats != nullptr) stats->Allocated(&stats->_lex, size);
+        return stats;
+    }
+
+    static inline void lex_freed(MemoryStats *stats, size_t size) {
+        if (stats != nullptr) stats->Freed(&stats->_lex, size);
+    }
+
     struct Lex : public ILex {
         Lex(const char *sql);
 
+        Lex(const Lex &other);
+
+        virtual ~Lex() { lex_freed(stats_, counted_); }
+
         virtual IToken *token() override { return &cur_tk_; }
 
         virtual ILex *clone() override { return new Lex(*this); }
 
         virtual void recover(ILex *state) override {
-            auto other = dynamic_cast<Lex*>(state);
-            if (other == nullptr) return;
+            if (state == nullptr) return;
+            auto other = static_cast<Lex*>(state);
             this->cur_tk_ = other->cur_tk_;
             this->sql_ = other->sql_;
+            this->cur_tk_.bind(sql_.c_str());
 
             this->pos_ = other->pos_;
             this->line_ = other->line_;
@@ -53,8 +91,42 @@ namespace GSP {
             //this->keyword1_ = other->keyword1_;
         }
 
+        virtual LexCheckpoint checkpoint() const override {
+            return {pos_, line_, col_, cur_tk_.type_, cur_tk_.off_, cur_tk_.len_, cur_tk_.escaped_, cur_tk_.msg_};
+        }
+
+        virtual void restore(const LexCheckpoint &cp) override {
+            if (cp.tk_escaped) {
+                /* rescan rather than saving the unescaped value in the checkpoint */
+                pos_ = cp.tk_off;
+                char quote = char_at(pos_);
+                scanf_quoted(cp.tk_type, quote == '[' ? ']' : quote, "");
+            } else if (cp.tk_type == ERR)
+                cur_tk_.set_err(cp.tk_msg, cp.tk_off, cp.tk_len);
+            else if (is_quoted(cp.tk_type, cp.tk_off))
+                cur_tk_.set_quoted(cp.tk_type, cp.tk_off, cp.tk_len);
+            else
+                cur_tk_.set(cp.tk_type, cp.tk_off, cp.tk_len);
+            pos_ = cp.pos;
+            line_ = cp.line;
+            col_ = cp.col;
+        }
+
         virtual void next() override { scanf(); }
 
+        virtual TokenType peek(unsigned int k) override {
+            if (k == 0) return cur_tk_.type_;
+            LexCheckpoint cp = checkpoint();
+            for (unsigned int i = 0; i < k; ++i) scanf();
+            TokenType tp = cur_tk_.type_;
+            restore(cp);
+            return tp;
+        }
+
+        virtual bool skip_parens() override;
+
+        virtual const char *text() const override { return sql_.c_str(); }
+
         virtual unsigned int cur_pos_line() const override { return line_; }
 
         virtual unsigned int cur_pos_col() const override { return col_; }
@@ -82,87 +154,87 @@ namespace GSP {
         void scanf_operator() {
             switch (char_at(pos())) {
                 case '^': {
-                    cur_tk_.set(CARET, "^");
+                    cur_tk_.set(CARET, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '%': {
-                    cur_tk_.set(PERCENT, "%");
+                    cur_tk_.set(PERCENT, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '+': {
-                    cur_tk_.set(PLUS, "+");
+                    cur_tk_.set(PLUS, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '-': {
-                    cur_tk_.set(MINUS, "-");
+                    cur_tk_.set(MINUS, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '*': {
-                    cur_tk_.set(STAR, "*");
+                    cur_tk_.set(STAR, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '/': {
-                    cur_tk_.set(DIVIDE, "/");
+                    cur_tk_.set(DIVIDE, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '.': {
-                    cur_tk_.set(DOT, ".");
+                    cur_tk_.set(DOT, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '(': {
-                    cur_tk_.set(LPAREN, "(");
+                    cur_tk_.set(LPAREN, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case ')': {
-                    cur_tk_.set(RPAREN, ")");
+                    cur_tk_.set(RPAREN, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case ',': {
-                    cur_tk_.set(COMMA, ",");
+                    cur_tk_.set(COMMA, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case ';': {
-                    cur_tk_.set(SEMI, ";");
+                    cur_tk_.set(SEMI, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '?': {
-                    cur_tk_.set(QUES, "?");
+                    cur_tk_.set(QUES, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '=': {
-                    cur_tk_.set(EQ, "=");
+                    cur_tk_.set(EQ, pos(), 1);
                     pos_inc(1);
                 }
                     break;
                 case '!': {
                     pos_inc(1);
                     if (char_at(pos()) == '=') {
-                        cur_tk_.set(LTGT, "!=");
+                        cur_tk_.set(LTGT, pos() - 1, 2);
                         pos_inc(1);
                     } else {
-                        cur_tk_.set(ERR, "EXPECTED '!='");
+                        cur_tk_.set_err("EXPECTED '!='", pos());
                     }
                 }
                     break;
                 case '>': {
                     pos_inc(1);
                     if (char_at(pos()) == '=') {
-                        cur_tk_.set(GTEQ, ">=");
+                        cur_tk_.set(GTEQ, pos() - 1, 2);
                         pos_inc(1);
                     } else {
-                        cur_tk_.set(GT, ">");
+                        cur_tk_.set(GT, pos() - 1, 1);
                     }
 
                 }
@@ -170,56 +242,70 @@ namespace GSP {
                 case '<': {
                     pos_inc(1);
                     if (char_at(pos()) == '=') {
-                        cur_tk_.set(LTEQ, "<=");
+                        cur_tk_.set(LTEQ, pos() - 1, 2);
                         pos_inc(1);
                     } else if (char_at(pos()) == '>') {
-                        cur_tk_.set(LTGT, "<>");
+                        cur_tk_.set(LTGT, pos() - 1, 2);
                         pos_inc(1);
                     } else {
-                        cur_tk_.set(LT, "<");
+                        cur_tk_.set(LT, pos() - 1, 1);
                     }
                 }
                     break;
                 case '|': {
                     pos_inc(1);
                     if (char_at(pos()) == '|') {
-                        cur_tk_.set(BARBAR, "||");
+                        cur_tk_.set(BARBAR, pos() - 1, 2);
                         pos_inc(1);
                     } else {
-                        cur_tk_.set(ERR, "EXPECTED '||'");
+                        cur_tk_.set_err("EXPECTED '||'", pos());
                     }
                 }
                     break;
                 default: {
-                    std::string err_s = "UNEXPECTED ";
-                    cur_tk_.set(ERR, err_s + char_at(pos()));
+                    cur_tk_.set_err("UNEXPECTED ", pos(), 1);
                 }
                     break;
             }
         }
 
         void scanf_str_literal() {
-            unsigned int start = pos();
             assert(char_at(pos()) == '\'');
-            pos_inc(1);
-            char c = char_at(pos());
-            std::stringstream buf{};
+            scanf_quoted(STR_LITERAL, '\'', "UNTERMINATED STRING LITERAL");
+        }
+
+        /* the token refers to the sql text, only doubled quotes make us build the unescaped value */
+        void scanf_quoted(TokenType tp, char close, const char *err) {
+            unsigned int start = pos();
+            unsigned int doubled = 0;
+            char c = char_at(pos_inc(1));
             while (c != EOI) {
-                if (c == '\'') {
-                    if (char_at(pos() + 1) == '\'') {
-                        buf << '\'';
+                if (c == close) {
+                    if (char_at(pos() + 1) == close) {
+                        ++doubled;
                         pos_inc(1);
                     } else
                         break;
-                } else
-                    buf << c;
+                }
                 c = char_at(pos_inc(1));
             }
-            if (c == '\'') {
-                pos_inc(1);
-                cur_tk_.set(STR_LITERAL, sub(start, pos()), buf.str());
-            } else
-                cur_tk_.set(ERR, "UNTERMINATED STRING LITERAL");
+            if (c != close) {
+                cur_tk_.set_err(err, pos());
+                return;
+            }
+            pos_inc(1);
+            if (doubled == 0) {
+                cur_tk_.set_quoted(tp, start, pos() - start);
+                return;
+            }
+            std::string buf;
+            buf.reserve(pos() - start - 2 - doubled);
+            for (unsigned int i = start + 1; i < pos() - 1; ++i) {
+                buf += sql_[i];
+                if (sql_[i] == close)
+                    ++i;
+            }
+            cur_tk_.set_escaped(tp, start, pos() - start, buf);
         }
 
         void scanf_identifier() {
@@ -227,63 +313,25 @@ namespace GSP {
             char c = char_at(pos());
             switch (c) {
                 case '"': {
-                    pos_inc(1);
-                    c = char_at(pos());
-                    std::stringstream buf{};
-                    while (c != EOI) {
-                        if (c == '"') {
-                            if (char_at(pos() + 1) == '"') {
-                                buf << '"';
-                                pos_inc(1);
-                            } else
-                                break;
-                        } else
-                            buf << c;
-                        c = char_at(pos_inc(1));
-                    }
-                    if (c == '"') {
-                        pos_inc(1);
-                        cur_tk_.set(ID, sub(start, pos()), buf.str());
-                    } else
-                        cur_tk_.set(ERR, "IDENTIFIER WITH UNTERMINATED \"");
+                    scanf_quoted(ID, '"', "IDENTIFIER WITH UNTERMINATED \"");
                 }
                     break;
                 case '[': {
-                    pos_inc(1);
-                    c = char_at(pos());
-                    std::stringstream buf{};
-                    while (c != EOI) {
-                        if (c == ']') {
-                            if (char_at(pos() + 1) == ']') {
-                                buf << ']';
-                                pos_inc(1);
-                            } else
-                                break;
-                        } else
-                            buf << c;
-                        c = char_at(pos_inc(1));
-                    }
-                    if (c == ']') {
-                        pos_inc(1);
-                        cur_tk_.set(ID, sub(start, pos()), buf.str());
-                    } else
-                        cur_tk_.set(ERR, "IDENTIFIER WITH UNTERMINATED [");
+                    scanf_quoted(ID, ']', "IDENTIFIER WITH UNTERMINATED [");
                 }
                     break;
                 default: {
                     if (is_identifier_begin(c)) {
-                        pos_inc(1);
-                        c = char_at(pos());
-                        while (is_identifier_body(c)) {
-                            c = char_at(pos_inc(1));
-                        }
-
-                        std::string s = sub(start, pos());
-                        if (!check_reserved_keyword(s))
-                            cur_tk_.set(ID, s);
+                        /* the nul of sql_ ends the scan, no bound check per character */
+                        const char *p = sql_.c_str() + pos() + 1;
+                        while (is_identifier_body(*p))
+                            ++p;
+                        pos_inc(p - sql_.c_str() - pos());
+
+                        if (!check_reserved_keyword(start, pos() - start))
+                            cur_tk_.set(ID, start, pos() - start);
                     } else {
-                        std::string err_s = "UNEXPECTED ";
-                        cur_tk_.set(ERR, err_s + c);
+                        cur_tk_.set_err("UNEXPECTED ", pos(), 1);
                     }
 
                 }
@@ -302,7 +350,7 @@ namespace GSP {
                     while (is_dec_body(c))
                         c = char_at(pos_inc(1));
                 } else {
-                    cur_tk_.set(ERR, "ERR NUMBER .");
+                    cur_tk_.set_err("ERR NUMBER .", pos());
                     return;
                 }
             } else {
@@ -313,7 +361,7 @@ namespace GSP {
                     c = char_at(pos_inc(1));
                     while (is_hex_body(c))
                         c = char_at(pos_inc(1));
-                    cur_tk_.set(NUMBER, sub(start, pos()));
+                    cur_tk_.set(NUMBER, start, pos() - start);
                     return;
                 } else {
                     while (is_dec_body(c))
@@ -336,11 +384,11 @@ namespace GSP {
                     while (is_dec_body(c))
                         c = char_at(pos_inc(1));
                 } else {
-                    cur_tk_.set(ERR, "ERR NUMBER E");
+                    cur_tk_.set_err("ERR NUMBER E", pos());
                     return;
                 }
             }
-            cur_tk_.set(NUMBER, sub(start, pos()));
+            cur_tk_.set(NUMBER, start, pos() - start);
         }
 
         bool is_dec_body(char c) {
@@ -363,6 +411,10 @@ namespace GSP {
             return is_identifier_begin(c) || ('0' <= c && c <= '9');
         }
 
+        bool is_quoted(TokenType tp, unsigned int off) {
+            return tp == STR_LITERAL || (tp == ID && (char_at(off) == '"' || char_at(off) == '['));
+        }
+
         bool is_white(char c) {
             return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
         }
@@ -371,7 +423,7 @@ namespace GSP {
             pos_ += inc;
             col_ += inc;
             if (pos_ > sql_.length())
-                cur_tk_.set(END_P, "");
+                cur_tk_.set(END_P, sql_.length(), 0);
             return pos_;
         }
 
@@ -384,14 +436,12 @@ namespace GSP {
 
         /* todo */
 #if 0
-        bool check_reserved_keyword(const std::string &word) { return false; }
+        bool check_reserved_keyword(unsigned int start, unsigned int len) { return false; }
 #else
-        bool check_reserved_keyword(const std::string &word) {
-            std::string big = word;
-            std::transform(big.begin(), big.end(), big.begin(), ::toupper);
-            auto it = keyword_.find(big);
-            if (it != keyword_.end()) {
-                cur_tk_.set(it->second, word);
+        bool check_reserved_keyword(unsigned int start, unsigned int len) {
+            TokenType tp = lookup_keyword(sql_.data() + start, len);
+            if (tp != none) {
+                cur_tk_.set(tp, start, len);
                 return true;
             }
             return false;
@@ -405,100 +455,203 @@ namespace GSP {
                 return EOI;
         }
 
-        std::string sub(unsigned int start, unsigned int end) {
-            return sql_.substr(start, end - start);
-        }
-
         Token cur_tk_;
         std::string sql_;
 
         unsigned int pos_;
         unsigned int line_;
         unsigned int col_;
-        static const std::map<std::string, TokenType> keyword_;
+        size_t counted_;    // the copy of the sql as counted by lex_allocated()
+        MemoryStats *stats_;
+        static TokenType lookup_keyword(const char *s, unsigned int len);
         static std::map<TokenType, std::string> keyword1_;
-        //std::vector<TokenType> hash_; /* todo */
     };
 
-    Token::Token() : type_(none) {}
-
-
-/* todo */
-const std::map<std::string, TokenType> Lex::    keyword_{
-            {"ALL",       ALL},
-            {"AND",       AND},
-            {"ANY",       ANY},
-            {"AS",        AS},
-            {"ASC",       ASC},
-            {"AVG",       AVG},
-            {"BETWEEN",   BETWEEN},
-            {"BY",        BY},
-            {"CASE",      CASE},
-            {"CAST",      CAST},
-            {"COLLATE",   COLLATE},
-            {"CONVERT",   CONVERT},
-            {"COUNT",     COUNT},
-            {"CROSS",     CROSS},
-            {"DEFAULT",   DEFAULT},
-            {"DELETE",    DELETE},
-            {"DESC",      DESC},
-            {"DISTINCT",  DISTINCT},
-            {"ELSE",      ELSE},
-            {"END",       END},
-            {"ESCAPE",    ESCAPE},
-            {"EXCEPT",    EXCEPT},
-            {"EXISTS",    EXISTS},
-            {"FALSE",     FALSE},
-            {"FROM",      FROM},
-            {"FULL",      FULL},
-            {"GROUP",     GROUP},
-            {"GROUPING",  GROUPING},
-            {"HAVING",    HAVING},
-            {"IN",        IN},
-            {"INNER",     INNER},
-            {"INSERT",    INSERT},
-            {"INTERSECT", INTERSECT},
-            {"INTERVAL",  INTERVAL},
-            {"INTO",      INTO},
-            {"IS",        IS},
-            {"JOIN",      JOIN},
-            {"LEFT",      LEFT},
-            {"LIKE",      LIKE},
-            {"MAX",       MAX},
-            {"MATCH",     MATCH},
-            {"MIN",       MIN},
-            {"NATURAL",   NATURAL},
-            {"NOT",       NOT},
-            {"NULLIF",    NULLIF},
-            {"NULL",      NULLX},
-            {"ON",        ON},
-            {"OR",        OR},
-            {"ORDER",     ORDER},
-            {"OUTER",     OUTER},
-            {"OVER",      OVER},
-            {"OVERLAPS",  OVERLAPS},
-            {"PARTIAL",   PARTIAL},
-            {"RANK",      RANK},
-            {"RIGHT",     RIGHT},
-            {"SELECT",    SELECT},
-            {"SET",       SET},
-            {"SOME",      SOME},
-            {"SUM",       SUM},
-            {"THEN",      THEN},
-            {"TO",        TO},
-            {"TRUE",      TRUE},
-            {"UNION",     UNION},
-            {"UNIQUE",    UNIQUE},
-            {"UNKNOWN",   UNKNOWN},
-            {"UPDATE",    UPDATE},
-            {"VALUES",    VALUES},
-            {"WHEN",      WHEN},
-            {"WHERE",     WHERE},
-            {"WITH",      WITH}
-    };
-    Lex::Lex(const char *sql) : sql_(sql), pos_(0), line_(0), col_(0)
+    Token::Token() : type_(none), src_(""), off_(0), len_(0), sem_off_(0), sem_len_(0), escaped_(false), msg_(nullptr) {}
+
+    const char *Token::word() const {
+        if (msg_ != nullptr) {
+            word_ = msg_;
+            word_.append(src_ + off_, len_);
+        } else
+            word_.assign(src_ + off_, len_);
+        return word_.c_str();
+    }
+
+    const char *Token::word_semantic() const {
+        if (escaped_) return unescaped_.c_str();
+        word1_.assign(src_ + sem_off_, sem_len_);
+        return word1_.c_str();
+    }
+
+
+    /* s is an identifier, so clearing bit 5 upper-cases its letters and never turns a digit or '_' into one */
+    static bool keyword_eq(const char *s, const char *keyword, unsigned int len) {
+        for (unsigned int i = 0; i < len; ++i) {
+            if ((s[i] & 0xDF) != keyword[i]) return false;
+        }
+        return true;
+    }
+
+    /* keyword table switched on length and first letter, no uppercase copy and no string compare but the last */
+    TokenType Lex::lookup_keyword(const char *s, unsigned int len) {
+        switch (len) {
+            case 2:
+                switch (s[0] & 0xDF) {
+                    case 'A': if (keyword_eq(s, "AS", 2)) return AS; break;
+                    case 'B': if (keyword_eq(s, "BY", 2)) return BY; break;
+                    case 'I':
+                        if (keyword_eq(s, "IN", 2)) return IN;
+                        if (keyword_eq(s, "IS", 2)) return IS;
+                        break;
+                    case 'O':
+                        if (keyword_eq(s, "ON", 2)) return ON;
+                        if (keyword_eq(s, "OR", 2)) return OR;
+                        break;
+                    case 'T': if (keyword_eq(s, "TO", 2)) return TO; break;
+                    default: break;
+                }
+                break;
+            case 3:
+                switch (s[0] & 0xDF) {
+                    case 'A':
+                        if (keyword_eq(s, "ALL", 3)) return ALL;
+                        if (keyword_eq(s, "AND", 3)) return AND;
+                        if (keyword_eq(s, "ANY", 3)) return ANY;
+                        if (keyword_eq(s, "ASC", 3)) return ASC;
+                        if (keyword_eq(s, "AVG", 3)) return AVG;
+                        break;
+                    case 'E': if (keyword_eq(s, "END", 3)) return END; break;
+                    case 'M':
+                        if (keyword_eq(s, "MAX", 3)) return MAX;
+                        if (keyword_eq(s, "MIN", 3)) return MIN;
+                        break;
+                    case 'N': if (keyword_eq(s, "NOT", 3)) return NOT; break;
+                    case 'S':
+                        if (keyword_eq(s, "SET", 3)) return SET;
+                        if (keyword_eq(s, "SUM", 3)) return SUM;
+                        break;
+                    default: break;
+                }
+                break;
+            case 4:
+                switch (s[0] & 0xDF) {
+                    case 'C':
+                        if (keyword_eq(s, "CASE", 4)) return CASE;
+                        if (keyword_eq(s, "CAST", 4)) return CAST;
+                        break;
+                    case 'D': if (keyword_eq(s, "DESC", 4)) return DESC; break;
+                    case 'E': if (keyword_eq(s, "ELSE", 4)) return ELSE; break;
+                    case 'F':
+                        if (keyword_eq(s, "FROM", 4)) return FROM;
+                        if (keyword_eq(s, "FULL", 4)) return FULL;
+                        break;
+                    case 'I': if (keyword_eq(s, "INTO", 4)) return INTO; break;
+                    case 'J': if (keyword_eq(s, "JOIN", 4)) return JOIN; break;
+                    case 'L':
+                        if (keyword_eq(s, "LEFT", 4)) return LEFT;
+                        if (keyword_eq(s, "LIKE", 4)) return LIKE;
+                        break;
+                    case 'N': if (keyword_eq(s, "NULL", 4)) return NULLX; break;
+                    case 'O': if (keyword_eq(s, "OVER", 4)) return OVER; break;
+                    case 'R': if (keyword_eq(s, "RANK", 4)) return RANK; break;
+                    case 'S': if (keyword_eq(s, "SOME", 4)) return SOME; break;
+                    case 'T':
+                        if (keyword_eq(s, "THEN", 4)) return THEN;
+                        if (keyword_eq(s, "TRUE", 4)) return TRUE;
+                        break;
+                    case 'W':
+                        if (keyword_eq(s, "WHEN", 4)) return WHEN;
+                        if (keyword_eq(s, "WITH", 4)) return WITH;
+                        break;
+                    default: break;
+                }
+                break;
+            case 5:
+                switch (s[0] & 0xDF) {
+                    case 'C':
+                        if (keyword_eq(s, "COUNT", 5)) return COUNT;
+                        if (keyword_eq(s, "CROSS", 5)) return CROSS;
+                        break;
+                    case 'F': if (keyword_eq(s, "FALSE", 5)) return FALSE; break;
+                    case 'G': if (keyword_eq(s, "GROUP", 5)) return GROUP; break;
+                    case 'I': if (keyword_eq(s, "INNER", 5)) return INNER; break;
+                    case 'M': if (keyword_eq(s, "MATCH", 5)) return MATCH; break;
+                    case 'O':
+                        if (keyword_eq(s, "ORDER", 5)) return ORDER;
+                        if (keyword_eq(s, "OUTER", 5)) return OUTER;
+                        break;
+                    case 'R': if (keyword_eq(s, "RIGHT", 5)) return RIGHT; break;
+                    case 'U': if (keyword_eq(s, "UNION", 5)) return UNION; break;
+                    case 'W': if (keyword_eq(s, "WHERE", 5)) return WHERE; break;
+                    default: break;
+                }
+                break;
+            case 6:
+                switch (s[0] & 0xDF) {
+                    case 'D': if (keyword_eq(s, "DELETE", 6)) return DELETE; break;
+                    case 'E':
+                        if (keyword_eq(s, "ESCAPE", 6)) return ESCAPE;
+                        if (keyword_eq(s, "EXCEPT", 6)) return EXCEPT;
+                        if (keyword_eq(s, "EXISTS", 6)) return EXISTS;
+                        break;
+                    case 'H': if (keyword_eq(s, "HAVING", 6)) return HAVING; break;
+                    case 'I': if (keyword_eq(s, "INSERT", 6)) return INSERT; break;
+                    case 'N': if (keyword_eq(s, "NULLIF", 6)) return NULLIF; break;
+                    case 'S': if (keyword_eq(s, "SELECT", 6)) return SELECT; break;
+                    case 'U':
+                        if (keyword_eq(s, "UNIQUE", 6)) return UNIQUE;
+                        if (keyword_eq(s, "UPDATE", 6)) return UPDATE;
+                        break;
+                    case 'V': if (keyword_eq(s, "VALUES", 6)) return VALUES; break;
+                    default: break;
+                }
+                break;
+            case 7:
+                switch (s[0] & 0xDF) {
+                    case 'B': if (keyword_eq(s, "BETWEEN", 7)) return BETWEEN; break;
+                    case 'C':
+                        if (keyword_eq(s, "COLLATE", 7)) return COLLATE;
+                        if (keyword_eq(s, "CONVERT", 7)) return CONVERT;
+                        break;
+                    case 'D': if (keyword_eq(s, "DEFAULT", 7)) return DEFAULT; break;
+                    case 'N': if (keyword_eq(s, "NATURAL", 7)) return NATURAL; break;
+                    case 'P': if (keyword_eq(s, "PARTIAL", 7)) return PARTIAL; break;
+                    case 'U': if (keyword_eq(s, "UNKNOWN", 7)) return UNKNOWN; break;
+                    default: break;
+                }
+                break;
+            case 8:
+                switch (s[0] & 0xDF) {
+                    case 'D': if (keyword_eq(s, "DISTINCT", 8)) return DISTINCT; break;
+                    case 'G': if (keyword_eq(s, "GROUPING", 8)) return GROUPING; break;
+                    case 'I': if (keyword_eq(s, "INTERVAL", 8)) return INTERVAL; break;
+                    case 'O': if (keyword_eq(s, "OVERLAPS", 8)) return OVERLAPS; break;
+                    default: break;
+                }
+                break;
+            case 9:
+                switch (s[0] & 0xDF) {
+                    case 'I': if (keyword_eq(s, "INTERSECT", 9)) return INTERSECT; break;
+                    case 'R': if (keyword_eq(s, "RECURSIVE", 9)) return RECURSIVE; break;
+                    default: break;
+                }
+                break;
+            default: break;
+        }
+        return none;
+    }
+    Lex::Lex(const char *sql) : sql_(sql), pos_(0), line_(0), col_(0), counted_(sql_.length() + 1)
     {
+        cur_tk_.bind(sql_.c_str());
+        stats_ = lex_allocated(counted_);
+    }
 
+    Lex::Lex(const Lex &other) : cur_tk_(other.cur_tk_), sql_(other.sql_), pos_(other.pos_), line_(other.line_), col_(other.col_),
+        counted_(sql_.length() + 1)
+    {
+        cur_tk_.bind(sql_.c_str());
+        stats_ = lex_allocated(counted_);
     }
 
     void Lex::scanf() {
@@ -570,7 +723,7 @@ const std::map<std::string, TokenType> Lex::    keyword_{
                 }
                     break;
                 case EOI: {
-                    cur_tk_.set(END_P, "");
+                    cur_tk_.set(END_P, sql_.length(), 0);
                     return;
                 }
                     break;
@@ -578,9 +731,7 @@ const std::map<std::string, TokenType> Lex::    keyword_{
                     if (is_identifier_begin(char_at(pos()))) {
                         return scanf_identifier();
                     } else {
-                        char c = char_at(pos());
-                        std::string err_s = "UNEXPECTED ";
-                        cur_tk_.set(ERR, err_s + c);
+                        cur_tk_.set_err("UNEXPECTED ", pos(), 1);
                         return;
                     }
                 }
@@ -590,12 +741,15 @@ const std::map<std::string, TokenType> Lex::    keyword_{
     }
 
     void Lex::white() {
-        char c = EOI;
-        while (is_white(c = char_at(pos()))) {
-            pos_inc(1);
-            if (c == '\n')
+        const char *p = sql_.c_str() + pos();
+        while (is_white(*p)) {
+            if (*p == '\n') {
+                pos_inc(p - sql_.c_str() - pos() + 1);
                 new_line();
+            }
+            ++p;
         }
+        pos_inc(p - sql_.c_str() - pos());
 
     }
 
@@ -631,11 +785,176 @@ const std::map<std::string, TokenType> Lex::    keyword_{
             pos_inc(2);  /* skip  */
         else {
             /* unterminated multiline comment */
-            cur_tk_.set(ERR, "unterminated multiline comment");
+            cur_tk_.set_err("unterminated multiline comment", pos());
+        }
+    }
+
+    /* a character scan that only knows quotes and comments, where a paren is no paren */
+    bool Lex::skip_parens() {
+        /* the tokens next() gives, so a bad token fails the skip as it fails a TokenLex */
+        unsigned int depth = 1;
+        for (;; scanf()) {
+            switch (cur_tk_.type_) {
+                case END_P:
+                case ERR:
+                    return false;
+                case LPAREN:
+                    ++depth;
+                    break;
+                case RPAREN:
+                    if (--depth == 0) return true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /* a token of a pre-tokenized statement, line_ and col_ are where Lex stood after scanning it */
+    struct CompactToken {
+        TokenType       type_;
+        unsigned int    off_;
+        unsigned int    len_;
+        unsigned int    line_;
+        unsigned int    col_;
+        unsigned int    unescaped_;     // 1 + index into TokenArray::unescaped_, 0 if not escaped
+    };
+
+    struct TokenArray {
+        ~TokenArray() { lex_freed(stats_, counted_); }
+        std::string                 sql_;
+        std::vector<CompactToken>   tokens_;    // [0] is the none token before the first next()
+        std::vector<std::string>    unescaped_;
+        const char                 *err_;       // message of a trailing ERR token
+        size_t                      counted_;   // by lex_allocated(), the sql was counted by the Lex that scanned it
+        MemoryStats                *stats_;
+    };
+
+    struct TokenLex : public ILex {
+        TokenLex(const char *sql);
+
+        TokenLex(const TokenLex &other);
+
+        virtual IToken *token() override { return &cur_tk_; }
+
+        virtual ILex *clone() override { return new TokenLex(*this); }
+
+        virtual void recover(ILex *state) override {
+            if (state == nullptr) return;
+            auto other = static_cast<TokenLex*>(state);
+            if (other->tokens_ != tokens_) return;
+            seek(other->idx_);
+        }
+
+        virtual LexCheckpoint checkpoint() const override {
+            return {(unsigned int)idx_, 0, 0, none, 0, 0, false, nullptr};
+        }
+
+        virtual void restore(const LexCheckpoint &cp) override { seek(cp.pos); }
+
+        virtual void next() override {
+            if (idx_ + 1 < tokens_->tokens_.size()) seek(idx_ + 1);
+        }
+
+        virtual TokenType peek(unsigned int k) override {
+            size_t i = idx_ + k;
+            if (i >= tokens_->tokens_.size()) i = tokens_->tokens_.size() - 1;
+            return tokens_->tokens_[i].type_;
+        }
+
+        virtual bool skip_parens() override;
+
+        virtual const char *text() const override { return tokens_->sql_.c_str(); }
+
+        virtual unsigned int cur_pos_line() const override { return tokens_->tokens_[idx_].line_; }
+
+        virtual unsigned int cur_pos_col() const override { return tokens_->tokens_[idx_].col_; }
+
+        virtual unsigned int cur_pos() const override {
+            const CompactToken &tk = tokens_->tokens_[idx_];
+            return tk.off_ + tk.len_;
+        }
+
+        virtual const std::string &get_token_type_name(TokenType token_type) const override {
+            static const std::string todo;
+            return todo;
+        }
+
+        void seek(size_t idx);
+
+        std::shared_ptr<const TokenArray>   tokens_;
+        size_t                              idx_;
+        Token                               cur_tk_;    // view of tokens_->tokens_[idx_]
+    };
+
+    TokenLex::TokenLex(const char *sql) : idx_(0) {
+        std::shared_ptr<TokenArray> tokens = std::make_shared<TokenArray>();
+        Lex lex(sql);
+        tokens->tokens_.reserve(lex.sql_.length() / 4 + 2);
+        tokens->tokens_.push_back({none, 0, 0, 0, 0, 0});
+        tokens->err_ = nullptr;
+        tokens->counted_ = 0;
+        tokens->stats_ = nullptr;
+        do {
+            lex.scanf();
+            const Token &tk = lex.cur_tk_;
+            unsigned int unescaped = 0;
+            if (tk.escaped_) {
+                tokens->unescaped_.push_back(tk.unescaped_);
+                unescaped = tokens->unescaped_.size();
+            }
+            if (tk.type_ == ERR) tokens->err_ = tk.msg_;
+            tokens->tokens_.push_back({tk.type_, tk.off_, tk.len_, lex.line_, lex.col_, unescaped});
+        } while (lex.cur_tk_.type_ != END_P && lex.cur_tk_.type_ != ERR);
+        tokens->sql_.swap(lex.sql_);
+        size_t size = tokens->tokens_.capacity() * sizeof(CompactToken);
+        for (auto &it : tokens->unescaped_) {
+            size += it.length() + 1;
+        }
+        tokens->stats_ = lex_allocated(size);
+        tokens->counted_ = size + lex.counted_;
+        lex.counted_ = 0;
+        tokens_ = tokens;
+        cur_tk_.bind(tokens_->sql_.c_str());
+    }
+
+    TokenLex::TokenLex(const TokenLex &other) : tokens_(other.tokens_), idx_(other.idx_), cur_tk_(other.cur_tk_) {}
+
+    void TokenLex::seek(size_t idx) {
+        idx_ = idx;
+        const CompactToken &tk = tokens_->tokens_[idx];
+        if (tk.unescaped_ != 0)
+            cur_tk_.set_escaped(tk.type_, tk.off_, tk.len_, tokens_->unescaped_[tk.unescaped_ - 1]);
+        else if (tk.type_ == ERR)
+            cur_tk_.set_err(tokens_->err_, tk.off_, tk.len_);
+        else if (tk.type_ == STR_LITERAL || (tk.type_ == ID && (tokens_->sql_[tk.off_] == '"' || tokens_->sql_[tk.off_] == '[')))
+            cur_tk_.set_quoted(tk.type_, tk.off_, tk.len_);
+        else
+            cur_tk_.set(tk.type_, tk.off_, tk.len_);
+    }
+
+    bool TokenLex::skip_parens() {
+        const std::vector<CompactToken> &tokens = tokens_->tokens_;
+        unsigned int depth = 1;
+        for (size_t i = idx_; i < tokens.size(); ++i) {
+            TokenType tp = tokens[i].type_;
+            if (tp == END_P || tp == ERR) {
+                seek(i);
+                return false;
+            }
+            if (tp == LPAREN) {
+                ++depth;
+            } else if (tp == RPAREN && --depth == 0) {
+                seek(i);
+                return true;
+            }
         }
+        return false;
     }
 
-    ILex *make_lex(const char *sql) {
+    ILex *make_lex(const char *sql, LexMode mode/* = LEX_STREAM*/) {
+        if (mode == LEX_TOKENIZED)
+            return new TokenLex(sql);
         return new Lex(sql);
     }
 
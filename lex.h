@@ -66,6 +66,26 @@ namespace GSP {
         virtual const char *word() const = 0;
 
         virtual const char *word_semantic() const = 0;
+
+        /* the lexeme is the range [offset, offset + length) of the sql given to make_lex */
+        virtual unsigned int offset() const = 0;
+
+        virtual unsigned int length() const = 0;
+
+        /* what went wrong for an ERR token, a string literal, null for any other */
+        virtual const char *message() const = 0;
+    };
+
+    /* what ILex::checkpoint() saves: position and current token, no copy of the sql */
+    struct LexCheckpoint {
+        unsigned int    pos;        // token index for a LEX_TOKENIZED lexer
+        unsigned int    line;
+        unsigned int    col;
+        TokenType       tk_type;
+        unsigned int    tk_off;
+        unsigned int    tk_len;
+        bool            tk_escaped;
+        const char     *tk_msg;
     };
 
     struct ILex {
@@ -75,10 +95,29 @@ namespace GSP {
 
         virtual ILex *clone() = 0;
 
+        /* state must come from clone() of this lexer */
         virtual void recover(ILex *state) = 0;
 
+        /* cheap alternative to clone()/recover() for backtracking, neither allocates */
+        virtual LexCheckpoint checkpoint() const = 0;
+
+        virtual void restore(const LexCheckpoint &cp) = 0;
+
         virtual void next() = 0;
 
+        /* type of the k-th token after the current one, peek(0) is token()->type() */
+        virtual TokenType peek(unsigned int k) = 0;
+
+        /*
+         * move to the right paren closing a left paren consumed before the current token, it becomes
+         * the current token. the tokens between are scanned, not parsed. false at the end of the sql or
+         * on a bad token, which becomes the current token; both lexer modes stop at the same one
+         */
+        virtual bool skip_parens() = 0;
+
+        /* the sql given to make_lex, token offsets index it */
+        virtual const char *text() const = 0;
+
         virtual unsigned int cur_pos_line() const = 0;
 
         virtual unsigned int cur_pos_col() const = 0;
@@ -88,7 +127,14 @@ namespace GSP {
         virtual const std::string &get_token_type_name(TokenType) const = 0;
     };
 
-    ILex *make_lex(const char *sql);
+    /*
+     * LEX_STREAM scans one token per next().
+     * LEX_TOKENIZED scans the whole sql once into a token array, the lexer is then a cursor over it,
+     * so clone()/recover() copy an index and peek() costs nothing.
+     */
+    enum LexMode { LEX_STREAM, LEX_TOKENIZED };
+
+    ILex *make_lex(const char *sql, LexMode mode = LEX_STREAM);
 
     void free_lex(ILex *lex);
 
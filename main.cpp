@@ -6,279 +6,33 @@
 #include "sql_select_stmt.h"
 #include "sql_table_ref.h"
 #include "sql_expression.h"
+#include "arena.h"
+#include "parse_script.h"
+#include "fingerprint.h"
+#include "stmt_cache.h"
+#include "flat_ast.h"
+#include "ast_file.h"
+#include "ast_hash.h"
+#include "table_refs.h"
+#include "policy_program.h"
 #include <time.h>
+#include <chrono>
 #include <map>
-#include <stack>
+#include <algorithm>
 #include "relational_algebra.h"
 #include "translate.h"
 
 enum BOOL_CONSTANT { BC_TRUE = 1, BC_FALSE=0, BC_UNKNOWN=-1 };
 
-enum OPER { OP_OR, OP_AND, OP_GT, OP_LT };
-
-const char* op2str(OPER op) {
-    switch (op) {
-        case OP_OR: return "OR";
-        case OP_AND: return "AND";
-        case OP_GT: return ">";
-        case OP_LT: return "<";
-    }
-}
-
-unsigned int make_new_label() {
-    static unsigned int i = 1;
-    return i++;
-}
-
-struct Instruction {
-    enum { PUSH_CONSTANT, PUSH_VARIABLE, EXEC_OPERATOR, JUMP, C_JUMP, LAB } _type;
-    union {
-        int _constant;
-        char *_var_name;
-        OPER _op;
-        unsigned int _jump_label;
-        unsigned int _lab;
-        struct {
-            BOOL_CONSTANT _when;
-            unsigned int _c_jump_label;
-        } _c_jump;
-    } u;
-};
-
-void dump(const std::vector<Instruction*>& instructions) {
-    for (auto it : instructions) {
-        switch (it->_type) {
-            case Instruction::PUSH_CONSTANT: {
-                printf("     PUSH_CONSTANT %d\n", it->u._constant);
-            } break;
-            case Instruction::PUSH_VARIABLE: {
-                printf("     PUSH VARIABLE %s\n", it->u._var_name);
-            } break;
-            case Instruction::EXEC_OPERATOR: {
-                printf("     EXEC_OPERATOR %s\n", op2str(it->u._op));
-            } break;
-            case Instruction::JUMP: {
-                printf("     JUMP      LAB%d\n", it->u._jump_label);
-            } break;
-            case Instruction::C_JUMP: {
-                printf("     CJUMP  %d LAB%d\n", it->u._c_jump._when, it->u._c_jump._c_jump_label);
-            } break;
-            case Instruction::LAB: {
-                printf("LAB%d\n", it->u._lab);
-            } break;
-            default: assert(false);
-        }
-    }
-}
-
-Instruction *make_push_var(const char *var) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::PUSH_VARIABLE;
-    ins->u._var_name = strdup(var);
-    return ins;
-}
-
-Instruction *make_push_int(int d) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::PUSH_CONSTANT;
-    ins->u._constant = d;
-    return ins;
-}
-
-Instruction *make_exec_op(OPER op) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::EXEC_OPERATOR;
-    ins->u._op = op;
-    return ins;
-}
-
-Instruction *make_c_jump(BOOL_CONSTANT when, unsigned int label) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::C_JUMP;
-    ins->u._c_jump._when = when;
-    ins->u._c_jump._c_jump_label = label;
-    return ins;
-}
-
-Instruction *make_jump(unsigned int label) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::JUMP;
-    ins->u._jump_label = label;
-    return ins;
-}
-
-
-Instruction *make_lb(unsigned int label) {
-    Instruction *ins = new Instruction;
-    ins->_type = Instruction::LAB;
-    ins->u._lab = label;
-    return ins;
-}
-
-void translate(GSP::AstSearchCondition *condition, std::vector<Instruction*>& instructions) {
-    switch (condition->GetExprType()) {
-        case GSP::AstSearchCondition::OR: {
-            GSP::AstBinaryOpExpr *or_expr = dynamic_cast<GSP::AstBinaryOpExpr*>(condition);
-            translate(or_expr->GetLeft(), instructions);
-            unsigned int lab1 = make_new_label();
-            Instruction *cjmp = make_c_jump(BC_TRUE, lab1);
-            instructions.push_back(cjmp);
-            translate(or_expr->GetRight(), instructions);
-            instructions.push_back(make_exec_op(OP_OR));
-            //unsigned int lab2 = make_new_label();
-            //instructions.push_back(make_jump(lab2));
-            instructions.push_back(make_lb(lab1));
-            //instructions.push_back(make_lb(lab2));
-        } break;
-        case GSP::AstSearchCondition::AND: {
-            GSP::AstBinaryOpExpr *or_expr = dynamic_cast<GSP::AstBinaryOpExpr*>(condition);
-            translate(or_expr->GetLeft(), instructions);
-            unsigned int lab1 = make_new_label();
-            Instruction *cjmp = make_c_jump(BC_FALSE, lab1);
-            instructions.push_back(cjmp);
-            translate(or_expr->GetRight(), instructions);
-            instructions.push_back(make_exec_op(OP_AND));
-            //unsigned int lab2 = make_new_label();
-            //instructions.push_back(make_jump(lab2));
-            instructions.push_back(make_lb(lab1));
-            //instructions.push_back(make_lb(lab2));
-        } break;
-        case GSP::AstSearchCondition::COMP_GT: {
-            GSP::AstBinaryOpExpr *gt_expr = dynamic_cast<GSP::AstBinaryOpExpr*>(condition);
-            translate(gt_expr->GetLeft(), instructions);
-            translate(gt_expr->GetRight(), instructions);
-            instructions.push_back(make_exec_op(OP_GT));
-        } break;
-        case GSP::AstSearchCondition::COMP_LT: {
-            GSP::AstBinaryOpExpr *gt_expr = dynamic_cast<GSP::AstBinaryOpExpr*>(condition);
-            translate(gt_expr->GetLeft(), instructions);
-            translate(gt_expr->GetRight(), instructions);
-            instructions.push_back(make_exec_op(OP_LT));
-        } break;
-        case GSP::AstSearchCondition::EXPR_COLUMN_REF: {
-            const GSP::AstIds& col = dynamic_cast<GSP::AstColumnRef*>(condition)->GetColumn();
-            GSP::AstId *id = col[0];
-            instructions.push_back(make_push_var(id->GetId().c_str()));
-        } break;
-        case GSP::AstSearchCondition::C_NUMBER: {
-            GSP::AstConstantValue *value = dynamic_cast<GSP::AstConstantValue*>(condition);
-            instructions.push_back(make_push_int(value->GetValueAsInt()));
-        } break;
-        default: { assert(false); } break;
-    }
-}
-
-void link(std::vector<Instruction*>& instructions) {
-    std::map<int, int> labs; // labid, lineid
-    for (int i = instructions.size()-1; i > -1; --i) {
-        if (instructions[i]->_type == Instruction::LAB) labs[instructions[i]->u._lab] = i;
-        if (instructions[i]->_type == Instruction::C_JUMP) {
-            auto fd = labs.find(instructions[i]->u._c_jump._c_jump_label);
-            assert(fd != labs.end());
-            instructions[i]->u._c_jump._c_jump_label = fd->second;
-        }
-    }
-}
-const std::string M = "M";
-const std::string N = "N";
-
 #define M_V -5
 #define N_V 10
 
 #define MN_CND "M>3 OR (M<0 AND N>3) AND (N < 100 OR M > 10 OR M > 109 AND N < 231) "
 
-int value(std::vector<Instruction*>& instructions) {
-    std::stack<int> stk;
-
-    for (int i = 0; i < instructions.size();) {
-        Instruction *it = instructions[i];
-        switch (it->_type) {
-            case Instruction::LAB: { ++i; } break;
-            case Instruction::PUSH_VARIABLE: {
-
-                if (it->u._var_name == M)
-                    stk.push(M_V);
-                else if (it->u._var_name == N)
-                    stk.push(N_V);
-                ++i;
-            } break;
-            case Instruction::PUSH_CONSTANT: {
-                stk.push(it->u._constant);
-                ++i;
-            } break;
-            case Instruction::C_JUMP: {
-                int top = stk.top();
-                if (top == it->u._c_jump._when) {
-                    i = it->u._c_jump._c_jump_label;
-                }
-                else
-                    ++i;
-            } break;
-            case Instruction::EXEC_OPERATOR: {
-                int right = stk.top(); stk.pop();
-                int left = stk.top(); stk.pop();
-                switch (it->u._op) {
-                    case OP_LT: {
-                        if (left == BC_UNKNOWN) {
-                            stk.push(BC_UNKNOWN);
-                            ++i;
-                            continue;
-                        }
-                        stk.push(left < right ? BC_TRUE : BC_FALSE);
-                        ++i;
-                    } break;
-                    case OP_GT: {
-                        if (left == BC_UNKNOWN) {
-                            stk.push(BC_UNKNOWN);
-                            ++i;
-                            continue;
-                        }
-                        stk.push(left > right ? BC_TRUE : BC_FALSE);
-                        ++i;
-                    } break;
-                    case OP_AND: {
-                        if (left == BC_FALSE || right == BC_FALSE) {
-                            stk.push(BC_FALSE);
-                            ++i;
-                            continue;
-                        } else if (left == BC_UNKNOWN || right == BC_UNKNOWN) {
-                            stk.push(BC_UNKNOWN);
-                            ++i;
-                            continue;
-                        } else {
-                            stk.push(BC_TRUE);
-                            ++i;
-                            continue;
-                        }
-                    } break;
-                    case OP_OR: {
-                        if (left == BC_TRUE || right == BC_TRUE) {
-                            stk.push(BC_TRUE);
-                            ++i;
-                            continue;
-                        } else if (left == BC_UNKNOWN || right == BC_UNKNOWN) {
-                            stk.push(BC_UNKNOWN);
-                            ++i;
-                            continue;
-                        } else {
-                            stk.push(BC_FALSE);
-                            ++i;
-                            continue;
-                        }
-                    }
-                }
-
-            }
-        }
-    }
-    assert(stk.size() == 1);
-    return stk.top();
-}
-
 int value1(GSP::AstSearchCondition *condition) {
     switch (condition->GetExprType()) {
         case GSP::AstSearchCondition::OR: {
-            auto or_exp = dynamic_cast<GSP::AstBinaryOpExpr *>(condition);
+            auto or_exp = static_cast<GSP::AstBinaryOpExpr *>(condition);
             int left = value1(or_exp->GetLeft());
             if (left == BC_TRUE) return BC_TRUE;
             int right = value1(or_exp->GetRight());
@@ -288,7 +42,7 @@ int value1(GSP::AstSearchCondition *condition) {
         }
             break;
         case GSP::AstSearchCondition::AND: {
-            auto and_exp = dynamic_cast<GSP::AstBinaryOpExpr *>(condition);
+            auto and_exp = static_cast<GSP::AstBinaryOpExpr *>(condition);
             int left = value1(and_exp->GetLeft());
             if (left == BC_FALSE) return BC_FALSE;
             int right = value1(and_exp->GetRight());
@@ -298,7 +52,7 @@ int value1(GSP::AstSearchCondition *condition) {
         }
             break;
         case GSP::AstSearchCondition::COMP_GT: {
-            auto predicate = dynamic_cast<GSP::AstBinaryOpExpr *>(condition);
+            auto predicate = static_cast<GSP::AstBinaryOpExpr *>(condition);
             int left = value1(predicate->GetLeft());
             if (left == BC_UNKNOWN) return BC_UNKNOWN;
             int right = value1(predicate->GetRight());
@@ -307,7 +61,7 @@ int value1(GSP::AstSearchCondition *condition) {
         }
             break;
         case GSP::AstSearchCondition::COMP_LT: {
-            auto predicate = dynamic_cast<GSP::AstBinaryOpExpr *>(condition);
+            auto predicate = static_cast<GSP::AstBinaryOpExpr *>(condition);
             int left = value1(predicate->GetLeft());
             if (left == BC_UNKNOWN) return BC_UNKNOWN;
             int right = value1(predicate->GetRight());
@@ -316,14 +70,14 @@ int value1(GSP::AstSearchCondition *condition) {
         }
             break;
         case GSP::AstSearchCondition::EXPR_COLUMN_REF: {
-            const GSP::AstIds &col = dynamic_cast<GSP::AstColumnRef *>(condition)->GetColumn();
+            const GSP::AstIds &col = static_cast<GSP::AstColumnRef *>(condition)->GetColumn();
             GSP::AstId *id = col[0];
             if (id->GetId() == "M") return M_V;
             else if (id->GetId() == "N") return N_V;
         }
             break;
         case GSP::AstSearchCondition::C_NUMBER: {
-            return dynamic_cast<GSP::AstConstantValue *>(condition)->GetValueAsInt();
+            return static_cast<GSP::AstConstantValue *>(condition)->GetValueAsInt();
         }
             break;
         default: {
@@ -333,6 +87,54 @@ int value1(GSP::AstSearchCondition *condition) {
     }
 }
 
+/* value1 over the flat form */
+int value2(const GSP::FlatAst& ast, uint32_t node) {
+    switch (ast.GetKind(node)) {
+        case GSP::AstSearchCondition::OR: {
+            int left = value2(ast, ast.GetChild(node, 0));
+            if (left == BC_TRUE) return BC_TRUE;
+            int right = value2(ast, ast.GetChild(node, 1));
+            if (right == BC_TRUE) return BC_TRUE;
+            if (left == BC_UNKNOWN || right == BC_UNKNOWN) return BC_UNKNOWN;
+            return false;
+        }
+        case GSP::AstSearchCondition::AND: {
+            int left = value2(ast, ast.GetChild(node, 0));
+            if (left == BC_FALSE) return BC_FALSE;
+            int right = value2(ast, ast.GetChild(node, 1));
+            if (right == BC_FALSE) return BC_FALSE;
+            if (left == BC_UNKNOWN || right == BC_UNKNOWN) return BC_UNKNOWN;
+            return true;
+        }
+        case GSP::AstSearchCondition::COMP_GT: {
+            int left = value2(ast, ast.GetChild(node, 0));
+            if (left == BC_UNKNOWN) return BC_UNKNOWN;
+            int right = value2(ast, ast.GetChild(node, 1));
+            if (left > right) return BC_TRUE;
+            return BC_FALSE;
+        }
+        case GSP::AstSearchCondition::COMP_LT: {
+            int left = value2(ast, ast.GetChild(node, 0));
+            if (left == BC_UNKNOWN) return BC_UNKNOWN;
+            int right = value2(ast, ast.GetChild(node, 1));
+            if (left < right) return BC_TRUE;
+            return BC_FALSE;
+        }
+        case GSP::AstSearchCondition::EXPR_COLUMN_REF: {
+            const char *id = ast.GetValue(ast.GetChild(node, 0));
+            if (strcmp(id, "M") == 0) return M_V;
+            else if (strcmp(id, "N") == 0) return N_V;
+        } break;
+        case GSP::AstSearchCondition::C_NUMBER: {
+            return atoi(ast.GetValue(node));
+        }
+        default: {
+            assert(false);
+        } break;
+    }
+    return BC_UNKNOWN;
+}
+
 void dump(GSP::AstSearchCondition *condition, int lvl = 0) {
     for (int i = 0; i < lvl; ++i)
         printf("   ");
@@ -349,29 +151,29 @@ void dump(GSP::AstSearchCondition *condition, int lvl = 0) {
                 case GSP::AstSearchCondition::COMP_GT: printf("|-GT\n"); break;
                 case GSP::AstSearchCondition::COMP_LT: printf("|-LT\n"); break;
             }
-            dump(dynamic_cast<GSP::AstBinaryOpExpr*>(condition)->GetLeft(), lvl+1);
-            dump(dynamic_cast<GSP::AstBinaryOpExpr*>(condition)->GetRight(), lvl+1);
+            dump(static_cast<GSP::AstBinaryOpExpr*>(condition)->GetLeft(), lvl+1);
+            dump(static_cast<GSP::AstBinaryOpExpr*>(condition)->GetRight(), lvl+1);
         }
             break;
         case GSP::AstSearchCondition::EXPR_COLUMN_REF: {
-            const GSP::AstIds &col = dynamic_cast<GSP::AstColumnRef *>(condition)->GetColumn();
+            const GSP::AstIds &col = static_cast<GSP::AstColumnRef *>(condition)->GetColumn();
             std::string id;
             for (int i = 0; i < col.size(); ++i) {
                 if (i == 0) {
-                    id += col[i]->GetId();
+                    id += col[i]->GetId().c_str();
                 } else {
-                    id += "." + col[i]->GetId();
+                    id += "."; id += col[i]->GetId().c_str();
                 }
             }
             printf("|-%s\n", id.c_str());
         }
             break;
         case GSP::AstSearchCondition::C_NUMBER: {
-            printf("|-%d\n", dynamic_cast<GSP::AstConstantValue *>(condition)->GetValueAsInt());
+            printf("|-%d\n", static_cast<GSP::AstConstantValue *>(condition)->GetValueAsInt());
         }
             break;
         case GSP::AstSearchCondition::C_STRING: {
-            printf("|-%s\n", dynamic_cast<GSP::AstConstantValue *>(condition)->GetValue());
+            printf("|-%s\n", static_cast<GSP::AstConstantValue *>(condition)->GetValue());
         } break;
         default: {
             assert(false);
@@ -470,45 +272,780 @@ int main() {
 
         std::string condition = MN_CND;
 
-        clock_t start = clock();
         GSP::ILex *lex = GSP::make_lex(condition.c_str());
         lex->next();
         GSP::ParseException e;
         GSP::AstSearchCondition *search_condition = GSP::parse_search_condition(lex, &e);
-        //printf("total: %d\n", clock() - start);
+        GSP::free_lex(lex);
         dump(search_condition);
-        std::vector<Instruction*> instructions;
-        translate(search_condition, instructions);
-        dump(instructions);
-        link(instructions);
+        GSP::PolicyException pe;
+        GSP::PolicyAttributes attributes;
+        GSP::PolicyProgram *program = GSP::compile_policy(search_condition, &attributes, &pe);
+        assert(pe._code == GSP::PolicyException::SUCCESS);
+        printf("%s", program->ToString().c_str());
+        assert(program->GetUnfusedSize() == 34 && program->GetCode().size() == 16);
+        GSP::PolicyRequest values(attributes);
+        values.SetInt(attributes.Find("M"), M_V);
+        values.SetInt(attributes.Find("N"), N_V);
+        assert(value1(search_condition) == program->Evaluate(values));
 
+        /* a second policy of the set shares the slots, what a request leaves out is unknown */
+        lex = GSP::make_lex("N > 3 AND resource.spe.url > 7");
+        lex->next();
+        GSP::AstSearchCondition *second = GSP::parse_search_condition(lex, &e);
+        GSP::free_lex(lex);
+        GSP::PolicyProgram *second_program = GSP::compile_policy(second, &attributes, &pe);
+        assert(attributes.GetSize() == 3 && attributes.Find("resource.spe.url") == 2 && second_program->GetSlots().size() == 2);
+        GSP::PolicyRequest request(attributes);
+        request.SetInt(attributes.Find("N"), 10);
+        assert(second_program->Evaluate(request) == GSP::B_UNKNOWN);
+        request.SetInt(attributes.Find("resource.spe.url"), 8);
+        assert(second_program->Evaluate(request) == GSP::B_TRUE);
+        request.Clear();
+        request.SetInt(attributes.Find("N"), 1);
+        assert(second_program->Evaluate(request) == GSP::B_FALSE && !request.IsSet(attributes.Find("resource.spe.url")));
+        delete (second_program);
+        delete (second);
 
-        //assert(1==0);
-        assert(value1(search_condition) == value(instructions));
+        /* the stack a program needs is its own, not how deep the condition nests */
+        assert(program->GetMaxStack() == 6);
+        std::string chain = "url > 0", nested = "url > 0";
+        for (int i = 1; i < 500; ++i) {
+            chain += " OR url > " + std::to_string(i);
+            nested = "url > " + std::to_string(i) + " OR (" + nested + ")";
+        }
+        for (int i = 0; i < 2; ++i) {
+            lex = GSP::make_lex(i == 0 ? chain.c_str() : nested.c_str());
+            lex->next();
+            GSP::AstSearchCondition *long_condition = GSP::parse_search_condition(lex, &e);
+            GSP::free_lex(lex);
+            GSP::PolicyProgram *long_program = GSP::compile_policy(long_condition, &attributes, &pe);
+            if (i == 0) {
+                assert(long_program != nullptr && long_program->GetMaxStack() == 3);
+            } else {
+                assert(long_program == nullptr && pe._code == GSP::PolicyException::FAIL);
+                pe._code = GSP::PolicyException::SUCCESS;
+            }
+            delete (long_program);
+            delete (long_condition);
+        }
 
-#if 0
+        const int n = 1000000;
+        clock_t start = clock();
+        int v = 0;
+        for (int i = 0; i < n; ++i) v += value1(search_condition);
+        double tree = (double)(clock() - start) * 1000000000 / CLOCKS_PER_SEC / n;
         start = clock();
-        for (int i = 0; i < 100000; ++i) {
-            int v1 = value1(search_condition);
-            //int v = value(instructions);
-            //assert(v == v1);
-        }
-        printf("total1: %d\n", clock() - start);
-#else
+        for (int i = 0; i < n; ++i) v -= program->Evaluate(values, GSP::DISPATCH_SWITCH);
+        double switched = (double)(clock() - start) * 1000000000 / CLOCKS_PER_SEC / n;
         start = clock();
-        for (int i = 0; i < 10; ++i) {
-            //int v1 = value1(search_condition);
-            int v = value(instructions);
-            //assert(v == v1);
+        for (int i = 0; i < n; ++i) v += program->Evaluate(values, GSP::DISPATCH_THREADED);
+        double threaded = (double)(clock() - start) * 1000000000 / CLOCKS_PER_SEC / n;
+        assert(v == n * value1(search_condition));
+        printf("policy: tree %.1f ns, switch %.1f ns, threaded %.1f ns\n", tree, switched, threaded);
+
+        /* a policy set: 200 policies over 64 attributes, requests that have 80% of them */
+        GSP::PolicyAttributes set_attributes;
+        std::vector<GSP::PolicyProgram*> policies, unfused;
+        srand(7);
+        for (int i = 0; i < 200; ++i) {
+            std::string text;
+            int terms = 4 + rand() % 28;
+            for (int t = 0; t < terms; ++t) {
+                std::string term = "attr" + std::to_string(rand() % 64) + (rand() % 2 ? " > " : " < ") + std::to_string(rand() % 100);
+                if (t == 0) text = term;
+                else if (t % 3 == 0) text = "(" + text + ") AND " + term;
+                else text += rand() % 2 ? " OR " + term : " AND " + term;
+            }
+            lex = GSP::make_lex(text.c_str());
+            lex->next();
+            GSP::AstSearchCondition *policy = GSP::parse_search_condition(lex, &e);
+            GSP::free_lex(lex);
+            policies.push_back(GSP::compile_policy(policy, &set_attributes, &pe));
+            unfused.push_back(GSP::compile_policy(policy, &set_attributes, &pe, false));
+            assert(policies.back() != nullptr && unfused.back()->GetCode().size() == policies.back()->GetUnfusedSize());
+            delete (policy);
+        }
+        std::vector<GSP::PolicyRequest> requests(100, GSP::PolicyRequest(set_attributes));
+        for (auto &it : requests) {
+            for (uint32_t slot = 0; slot < set_attributes.GetSize(); ++slot) {
+                if (rand() % 5 != 0) it.SetInt(slot, rand() % 100);
+            }
+        }
+        /* switch and threaded over the plain instructions, then both over the superinstructions */
+        double decisions[4];
+        int results[4] = {0, 0, 0, 0};
+        for (int d = 0; d < 4; ++d) {
+            GSP::PolicyDispatch dispatch = d % 2 == 0 ? GSP::DISPATCH_SWITCH : GSP::DISPATCH_THREADED;
+            std::vector<GSP::PolicyProgram*> &set = d < 2 ? unfused : policies;
+            start = clock();
+            for (int round = 0; round < 20; ++round) {
+                for (auto &request : requests) {
+                    for (auto policy : set) results[d] += policy->Evaluate(request, dispatch) + 1;
+                }
+            }
+            decisions[d] = 20.0 * requests.size() * set.size() * CLOCKS_PER_SEC / (clock() - start);
+        }
+        assert(results[0] == results[1] && results[1] == results[2] && results[2] == results[3]);
+        size_t before = 0, after = 0, unfused_bytes = 0, fused_bytes = 0;
+        double least = 1;
+        for (size_t i = 0; i < policies.size(); ++i) {
+            unfused_bytes += unfused[i]->GetRetainedSize();
+            fused_bytes += policies[i]->GetRetainedSize();
         }
-        printf("total: %d\n", clock() - start);
-#endif
+        assert(fused_bytes < unfused_bytes);
+        for (auto it : policies) {
+            before += it->GetUnfusedSize();
+            after += it->GetCode().size();
+            least = std::min(least, 1 - (double)it->GetCode().size() / it->GetUnfusedSize());
+        }
+        printf("policy set: switch %.2f M decisions/s, threaded %.2f M decisions/s\n", decisions[0] / 1e6, decisions[1] / 1e6);
+        printf("superinstructions: %zu to %zu instructions, %.0f%% fewer, at least %.0f%% per policy; "
+               "switch %.2f M decisions/s, threaded %.2f M decisions/s\n", before, after, (1 - (double)after / before) * 100,
+               least * 100, decisions[2] / 1e6, decisions[3] / 1e6);
+        printf("policy set memory: %zu bytes compiled, %zu without superinstructions\n", fused_bytes, unfused_bytes);
+        for (auto it : policies) delete (it);
+        for (auto it : unfused) delete (it);
 
+        /* the policy of design.txt: strings compare as the ids they were interned to */
+        GSP::PolicyAttributes design_attributes;
+        lex = GSP::make_lex("(emailaddress = 'james.polk@qapf1.qalab01.nextlabs.com') AND (Action = 'open') AND "
+                            "(resource.spe.url = 'sharepoint://**aclinv.aspx' OR resource.spe.url = 'sharepoint://**managefeatures.aspx' OR "
+                            "resource.spe.url = 'sharepoint://**projectsite**flat.aspx')");
+        lex->next();
+        GSP::AstSearchCondition *design = GSP::parse_search_condition(lex, &e);
+        GSP::free_lex(lex);
+        GSP::PolicyProgram *design_program = GSP::compile_policy(design, &design_attributes, &pe);
+        assert(design_program != nullptr && design_program->ToString().find("EQ_VAR_STR_JFALSE") != std::string::npos);
+        printf("%s", design_program->ToString().c_str());
+        GSP::PolicyRequest access(design_attributes);
+        access.SetString(design_attributes.Find("emailaddress"), "james.polk@qapf1.qalab01.nextlabs.com");
+        access.SetString(design_attributes.Find("Action"), "open");
+        assert(design_program->Evaluate(access) == GSP::B_UNKNOWN);
+        access.SetString(design_attributes.Find("resource.spe.url"), "sharepoint://**managefeatures.aspx");
+        assert(design_program->Evaluate(access) == GSP::B_TRUE && design_program->Evaluate(access, GSP::DISPATCH_SWITCH) == GSP::B_TRUE);
+        access.SetString(design_attributes.Find("Action"), "delete");     /* no policy mentions it */
+        assert(design_program->Evaluate(access) == GSP::B_FALSE && design_program->Evaluate(access, GSP::DISPATCH_SWITCH) == GSP::B_FALSE);
+        access.SetInt(design_attributes.Find("Action"), 1);
+        assert(design_program->Evaluate(access) == GSP::B_UNKNOWN);
+        delete (design_program);
+        delete (design);
 
+        /* two attributes compare by their strings, whether a policy mentions them or not */
+        lex = GSP::make_lex("owner = editor OR owner <> 'root' AND owner <> editor");
+        lex->next();
+        GSP::AstSearchCondition *columns = GSP::parse_search_condition(lex, &e);
+        GSP::free_lex(lex);
+        GSP::PolicyProgram *columns_program = GSP::compile_policy(columns, &design_attributes, &pe);
+        GSP::PolicyRequest owners(design_attributes);
+        owners.SetString(design_attributes.Find("owner"), "alice");
+        owners.SetString(design_attributes.Find("editor"), "alice");
+        assert(columns_program->Evaluate(owners) == GSP::B_TRUE);
+        owners.SetString(design_attributes.Find("editor"), "bob");
+        assert(columns_program->Evaluate(owners) == GSP::B_TRUE);
+        owners.SetString(design_attributes.Find("owner"), "root");
+        assert(columns_program->Evaluate(owners) == GSP::B_FALSE && columns_program->Evaluate(owners, GSP::DISPATCH_SWITCH) == GSP::B_FALSE);
+        owners.SetNull(design_attributes.Find("editor"));
+        assert(columns_program->Evaluate(owners) == GSP::B_UNKNOWN);
+        delete (columns_program);
+        delete (columns);
 
-        delete (lex);
+        /* numbers: -1 is a value like any other, an int compares with a double, NULL with nothing */
+        lex = GSP::make_lex("M > -2 AND N <= 2.5 AND N <> 2");
+        lex->next();
+        GSP::AstSearchCondition *numbers = GSP::parse_search_condition(lex, &e);
+        GSP::free_lex(lex);
+        GSP::PolicyProgram *numbers_program = GSP::compile_policy(numbers, &attributes, &pe);
+        assert(numbers_program != nullptr);
+        GSP::PolicyRequest typed(attributes);
+        typed.SetInt(attributes.Find("M"), -1);
+        typed.SetDouble(attributes.Find("N"), 2.25);
+        assert(numbers_program->Evaluate(typed) == GSP::B_TRUE);
+        typed.SetInt(attributes.Find("N"), 2);
+        assert(numbers_program->Evaluate(typed) == GSP::B_FALSE);
+        typed.SetNull(attributes.Find("N"));
+        assert(numbers_program->Evaluate(typed) == GSP::B_UNKNOWN && numbers_program->Evaluate(typed, GSP::DISPATCH_SWITCH) == GSP::B_UNKNOWN);
+        delete (numbers_program);
+        delete (numbers);
+
+        GSP::ILex *bad = GSP::make_lex("a < 'x' OR b > 1");
+        bad->next();
+        GSP::AstSearchCondition *unsupported = GSP::parse_search_condition(bad, &e);
+        assert(GSP::compile_policy(unsupported, &attributes, &pe) == nullptr && pe._code == GSP::PolicyException::FAIL);
+        GSP::free_lex(bad);
+        delete (unsupported);
+        delete (program);
         delete (search_condition);
-        //return 0;
+    }
+
+    {
+        /* both lexer modes give the same tokens, positions and parse on quoted, commented, erroneous and nested sql */
+        std::vector<std::string> queries = {
+            sql,
+            "SELECT a FROM (A JOIN B ON m=n), (SELECT m FROM PP) QQ",
+            "SELECT a FROM (((SELECT m FROM AA)) UNION SELECT kp) CC",
+            "WITH QQ(m,n) AS (SELECT 1, 1+2), MQ(m,n) AS (SELECT 2,2+3) SELECT * FROM QQ GROUP BY ALL m HAVING (SELECT 1) > -1 ORDER BY n ASC, m DESC",
+            "SELECT * FROM A NATURAL JOIN B JOIN (SELECT 1) C ON m=n",
+            "SELECT a,f(b)\nFROM t -- all of t\nWHERE c=42 AND d IN ('y''z', 7);",
+            "SELECT 'a;b' /* ; */ FROM \"x;y\" WHERE " MN_CND,
+            "SELECT a FROM t WHERE a IN ((SELECT 1 ORDER BY a) ORDER BY b)",
+            "SELECT a, b FROM t WHERE a = = 1",
+            "SELECT 'unterminated FROM t",
+            "SELECT a FROM (SELECT b FROM t",
+        };
+        for (auto &it : queries) {
+            GSP::ILex *stream = GSP::make_lex(it.c_str(), GSP::LEX_STREAM);
+            GSP::ILex *tokenized = GSP::make_lex(it.c_str(), GSP::LEX_TOKENIZED);
+            for (stream->next(), tokenized->next(); ; stream->next(), tokenized->next()) {
+                GSP::IToken *a = stream->token(), *b = tokenized->token();
+                (void)b;
+                assert(a->type() == b->type() && strcmp(a->word(), b->word()) == 0 && strcmp(a->word_semantic(), b->word_semantic()) == 0);
+                assert(a->offset() == b->offset() && a->length() == b->length());
+                assert(stream->cur_pos_line() == tokenized->cur_pos_line() && stream->cur_pos_col() == tokenized->cur_pos_col());
+                if (a->type() == GSP::END_P || a->type() == GSP::ERR) break;
+            }
+            GSP::free_lex(stream);
+            GSP::free_lex(tokenized);
+
+            /* peek() sees what next() will, restore() brings back the token and position a checkpoint() saw, escaped and erroneous ones too */
+            for (int m = 0; m < 2; ++m) {
+                GSP::ILex *lex = GSP::make_lex(it.c_str(), m == 0 ? GSP::LEX_STREAM : GSP::LEX_TOKENIZED);
+                for (lex->next(); ; lex->next()) {
+                    GSP::TokenType tp = lex->token()->type();
+                    std::string word = lex->token()->word_semantic();
+                    unsigned int off = lex->token()->offset(), line = lex->cur_pos_line(), col = lex->cur_pos_col();
+                    GSP::LexCheckpoint cp = lex->checkpoint();
+                    GSP::TokenType ahead[3];
+                    for (unsigned int k = 0; k < 3; ++k) ahead[k] = lex->peek(k + 1);
+                    for (int k = 0; k < 3; ++k) {
+                        lex->next();
+                        assert(lex->token()->type() == ahead[k]);
+                    }
+                    (void)ahead;
+                    lex->restore(cp);
+                    assert(lex->peek(0) == tp);
+                    assert(lex->token()->type() == tp && word == lex->token()->word_semantic() && lex->token()->offset() == off);
+                    assert(lex->cur_pos_line() == line && lex->cur_pos_col() == col);
+                    (void)tp; (void)off; (void)line; (void)col;
+                    if (tp == GSP::END_P || tp == GSP::ERR) break;
+                }
+                GSP::free_lex(lex);
+            }
+
+            GSP::ParseException e[2];
+            unsigned int end[2];
+            for (int m = 0; m < 2; ++m) {
+                GSP::ILex *lex = GSP::make_lex(it.c_str(), m == 0 ? GSP::LEX_STREAM : GSP::LEX_TOKENIZED);
+                lex->next();
+                GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e[m]);
+                end[m] = lex->token()->offset();
+                GSP::free_lex(lex);
+                delete (stmt);
+            }
+            assert(e[0]._code == e[1]._code && end[0] == end[1]);
+            (void)end;
+        }
+    }
+
+    {
+        /* identifiers and keywords per second through the lexer */
+        std::string words;
+        for (int i = 0; i < 20000; ++i)
+            words += "select a_column, Customer_Name from some_table where Order_id between group_by and Having_x ";
+        unsigned long identifiers = 0;
+        clock_t start = clock();
+        for (int i = 0; i < 10; ++i) {
+            GSP::ILex *lex = GSP::make_lex(words.c_str());
+            for (lex->next(); lex->token()->type() != GSP::END_P; lex->next()) {
+                if (lex->token()->type() != GSP::COMMA) ++identifiers;
+            }
+            GSP::free_lex(lex);
+        }
+        double secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("identifiers: %.0f/s\n", identifiers / secs);
+    }
+
+    {
+        /* pathological nesting, parse time has to grow linearly with the depth */
+        for (int depth = 64; depth <= 1024; depth *= 4) {
+            std::string nested = std::string(depth, '(') + "a+b" + std::string(depth, ')') + " = " +
+                                 std::string(depth, '(') + "SELECT 1" + std::string(depth, ')');
+            clock_t start = clock();
+            for (int i = 0; i < 100; ++i) {
+                GSP::ILex *lex = GSP::make_lex(nested.c_str());
+                lex->next();
+                GSP::ParseException e;
+                GSP::AstSearchCondition *condition = GSP::parse_search_condition(lex, &e);
+                assert(e._code == GSP::ParseException::SUCCESS && lex->token()->type() == GSP::END_P);
+                GSP::free_lex(lex);
+                delete (condition);
+            }
+            printf("nesting %d: %.3f ms\n", depth, (double)(clock() - start) * 1000 / CLOCKS_PER_SEC / 100);
+        }
+    }
+
+    {
+        /* the report above, one heap allocation per node against one arena reset per parse */
+        const int n = 10000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            assert(e._code == GSP::ParseException::SUCCESS);
+            GSP::free_lex(lex);
+            delete (stmt);
+        }
+        printf("heap: %.3f us/parse\n", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n);
+        GSP::Arena arena;
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            GSP::ParseException e;
+            GSP::parse_select_stmt(lex, &e, &arena);
+            assert(e._code == GSP::ParseException::SUCCESS);
+            GSP::free_lex(lex);
+            arena.Reset();
+        }
+        printf("arena: %.3f us/parse\n", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n);
+    }
+
+    {
+        /* a script of the report above, wall time per worker count */
+        std::string script;
+        for (int i = 0; i < 4000; ++i) {
+            script += sql.substr(0, sql.find(';'));
+            script += i % 2 ? ";\n-- next ';'\n" : "; /* ; */ SELECT 'a;b' FROM \"x;y\";\n";
+        }
+        for (unsigned int workers = 1; workers <= 8; workers *= 2) {
+            auto start = std::chrono::steady_clock::now();
+            GSP::Script *parsed = GSP::parse_script(script.c_str(), workers);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            assert(parsed->GetStmts().size() == 6000);
+            assert(std::all_of(parsed->GetStmts().begin(), parsed->GetStmts().end(), [](const GSP::ScriptStmt& it) { return it.stmt != nullptr; }));
+            printf("parse_script %u workers: %.1f ms\n", workers, ms);
+            delete (parsed);
+        }
+    }
+
+    {
+        /* statements of the same shape share a fingerprint */
+        GSP::ParseException e;
+        GSP::Fingerprint fp1 = GSP::fingerprint("select a, f (b) from t where c = 1 and d in ('x', 2.5)", &e);
+        GSP::Fingerprint fp2 = GSP::fingerprint("SELECT a,f(b)\nFROM t -- all of t\nWHERE c=42 AND d IN ('y''z', 7);", &e);
+        assert(e._code == GSP::ParseException::SUCCESS);
+        assert(fp1.hash == fp2.hash && fp1.text == fp2.text);
+        /* the literals are where they are in the sql, the hash is the same without the text */
+        const char *sql2 = "SELECT a,f(b)\nFROM t -- all of t\nWHERE c=42 AND d IN ('y''z', 7);";
+        GSP::Fingerprint fp3 = GSP::fingerprint(sql2, &e, false);
+        assert(fp3.hash == fp2.hash && fp3.text.empty() && fp3.literals.size() == 3);
+        assert(GSP::fingerprint_literal(sql2, fp3.literals[0]) == "42" && GSP::fingerprint_literal(sql2, fp3.literals[1]) == "y'z");
+        assert(fp3.literals[1].length == 6 && fp2.text[fp3.literals[1].pos] == '?');
+        (void)sql2;
+        printf("%016llx %s\n", (unsigned long long)fp1.hash, fp1.text.c_str());
+        const int n = 10000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            fp1 = GSP::fingerprint(sql.c_str(), &e);
+        }
+        double with_text = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            fp1 = GSP::fingerprint(sql.c_str(), &e, false);
+        }
+        printf("fingerprint: %.3f us/statement, %.3f us without the text\n", with_text,
+               (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n);
+    }
+
+    {
+        /* statements of a cached shape skip the parser */
+        GSP::StmtCache cache(1024);
+        GSP::ParseException e;
+        GSP::Arena arena;
+        GSP::AstSelectStmt *stmt = cache.Parse("SELECT a FROM t WHERE a = ? AND b = 1", &e, &arena);
+        stmt = cache.Parse("SELECT a FROM t WHERE a = 2 AND b = ?", &e, &arena);
+        GSP::AstExpr *a = static_cast<GSP::AstBinaryOpExpr *>(static_cast<GSP::AstQueryPrimary *>(stmt->GetBody())->GetWhere())->GetLeft();
+        assert(strcmp(static_cast<GSP::AstConstantValue *>(static_cast<GSP::AstBinaryOpExpr *>(a)->GetRight())->GetValue(), "2") == 0);
+        (void)a;
+
+        /* a bound statement shares the tree of the first one, its constants read the literals of the second */
+        const char *third = "SELECT a FROM t WHERE a = 'x''y' AND b = ?";
+        GSP::BoundStmt first, bound;
+        bool ok = cache.Bind("SELECT a FROM t WHERE a = 'w' AND b = ?", &e, &first) && cache.Bind(third, &e, &bound);
+        assert(ok && bound.GetStmt() == first.GetStmt());
+        a = static_cast<GSP::AstBinaryOpExpr *>(static_cast<GSP::AstQueryPrimary *>(bound.GetStmt()->GetBody())->GetWhere())->GetLeft();
+        GSP::AstConstantValue *slot = static_cast<GSP::AstConstantValue *>(static_cast<GSP::AstBinaryOpExpr *>(a)->GetRight());
+        assert(bound.GetValue(slot) == "x'y" && first.GetValue(slot) == "w" && strcmp(slot->GetValue(), "w") == 0);
+        (void)ok;
+        (void)slot;
+
+        const int n = 10000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            GSP::parse_select_stmt(lex, &e, &arena);
+            GSP::free_lex(lex);
+            arena.Reset();
+        }
+        double parsed = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            cache.Parse(sql.c_str(), &e, &arena);
+            assert(e._code == GSP::ParseException::SUCCESS);
+            arena.Reset();
+        }
+        double copied = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            ok = cache.Bind(sql.c_str(), &e, &bound);
+            assert(ok);
+        }
+        double bound_us = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        GSP::StmtCache::Stats stats = cache.GetStats();
+        printf("cached: parse %.3f us, hit with copy %.3f us, hit bound %.3f us; hits %llu misses %llu evictions %llu\n",
+               parsed, copied, bound_us,
+               (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.evictions);
+    }
+
+    {
+        /* a parenthesized query with an ORDER BY or a WITH of its own takes no other ORDER BY */
+        const char *nested_order[] = {
+            "SELECT a FROM t WHERE a IN ((SELECT 1 ORDER BY a) ORDER BY b)",
+            "SELECT a FROM t WHERE a > ((SELECT 1 ORDER BY a) ORDER BY b)",
+            "SELECT a FROM ((SELECT 1 ORDER BY a) ORDER BY b) x",
+        };
+        for (auto it : nested_order) {
+            GSP::ILex *lex = GSP::make_lex(it);
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            assert(e._code == GSP::ParseException::FAIL && stmt == nullptr);
+            GSP::free_lex(lex);
+            delete (stmt);
+        }
+
+        /* a flood of malformed statements, failing must not cost more than parsing */
+        const char *bad = "SELECT a, b FROM t WHERE a = = 1";
+        const int n = 200000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(bad);
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            assert(e._code == GSP::ParseException::FAIL && stmt == nullptr);
+            (void)stmt;
+            GSP::free_lex(lex);
+        }
+        printf("malformed: %.3f us/parse\n", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n);
+
+        /* the failure keeps where the token is, the message slices it from the sql, an ERR token adds what is wrong */
+        const char *operand = " EXPECT ( | IDENTIFIER | * | CASE | + | - | TRUE | FALSE | NULL | STRING LITERAL | NUMBER | ?";
+        const char *errs[][2] = {
+            { bad, "UNEXPECT = at(0,30)" },
+            { "SELECT a FROM t WHERE ! c", "UNEXPECT EXPECTED '!=' at(0,23)" },
+        };
+        for (auto &it : errs) {
+            GSP::ILex *lex = GSP::make_lex(it[0], GSP::LEX_TOKENIZED);
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::free_lex(lex);
+            assert(stmt == nullptr && e.GetDetail(it[0]) == std::string(it[1]) + operand);
+            (void)stmt;
+        }
+        (void)operand;
+    }
+
+    {
+        /* the statement as a flat pool, and back */
+        GSP::FlatAst flat;
+        GSP::ILex *lex = GSP::make_lex(sql.c_str());
+        lex->next();
+        GSP::ParseException e;
+        uint32_t root = GSP::parse_select_stmt(lex, &e, &flat);
+        GSP::free_lex(lex);
+        assert(root != GSP::FlatAst::NIL);
+        std::vector<std::string> names;
+        GSP::flat_table_names(flat, &names);
+        for (auto &it : names) printf("%s ", it.c_str());
+        printf("\n");
+        GSP::AstSelectStmt *stmt = flat.ToSelectStmt(root);
+        GSP::FlatAst again;
+        again.Append(stmt);
+        assert(again.Size() == flat.Size() && GSP::flat_fingerprint(again) == GSP::flat_fingerprint(flat));
+        delete (stmt);
+
+        const int n = 100000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            names.clear();
+            GSP::flat_table_names(flat, &names);
+        }
+        printf("flat table names: %.3f us/statement, %u nodes\n", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n, flat.Size());
+
+        lex = GSP::make_lex(MN_CND);
+        lex->next();
+        GSP::AstSearchCondition *condition = GSP::parse_search_condition(lex, &e);
+        GSP::free_lex(lex);
+        flat.Clear();
+        root = flat.Append(condition);
+        assert(value1(condition) == value2(flat, root));
+        start = clock();
+        int v = 0;
+        for (int i = 0; i < n; ++i) v += value1(condition);
+        printf("tree eval: %.3f ns\n", (double)(clock() - start) * 1000000000 / CLOCKS_PER_SEC / n);
+        start = clock();
+        for (int i = 0; i < n; ++i) v -= value2(flat, root);
+        printf("flat eval: %.3f ns\n", (double)(clock() - start) * 1000000000 / CLOCKS_PER_SEC / n);
+        assert(v == 0);
+        delete (condition);
+    }
+
+    {
+        /* stored conditions, parsed on a cold start and mapped on a warm one */
+        const int n = 200000;
+        std::vector<std::string> conditions;
+        for (int i = 0; i < n; ++i) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "M>%d OR (M<%d AND N>3) AND (N < %d OR M > 10 OR M > 109 AND N < %d)", i % 7, i % 5, i, i % 300);
+            conditions.push_back(buf);
+        }
+        clock_t start = clock();
+        GSP::FlatAst flat;
+        std::vector<uint32_t> roots;
+        for (auto &it : conditions) {
+            GSP::ILex *lex = GSP::make_lex(it.c_str());
+            lex->next();
+            GSP::ParseException e;
+            roots.push_back(GSP::parse_search_condition(lex, &e, &flat));
+            assert(e._code == GSP::ParseException::SUCCESS);
+            GSP::free_lex(lex);
+        }
+        printf("cold start: %.1f ms\n", (double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+        const char *tmp = getenv("TMPDIR");
+        std::string path = std::string(tmp != nullptr ? tmp : "/tmp") + "/gsp_conditions.ast";
+        bool saved = GSP::AstFile::Save(path.c_str(), flat, roots);
+        assert(saved);
+
+        start = clock();
+        GSP::AstFile file;
+        bool opened = file.Open(path.c_str());
+        assert(opened && file.GetRootCount() == roots.size());
+        const GSP::FlatAst& mapped = file.GetAst();
+        int v = 0;
+        for (uint32_t i = 0; i < file.GetRootCount(); ++i) {
+            v += value2(mapped, file.GetRoot(i));
+        }
+        printf("warm start: %.1f ms, %u nodes\n", (double)(clock() - start) * 1000 / CLOCKS_PER_SEC, mapped.Size());
+        for (uint32_t i = 0; i < roots.size(); ++i) {
+            v -= value2(flat, roots[i]);
+        }
+        assert(v == 0);
+
+        assert(mapped.Size() == flat.Size());
+        for (uint32_t i = 0; i < flat.Size(); ++i) {
+            assert(mapped.GetKind(i) == flat.GetKind(i) && mapped.GetFlag(i) == flat.GetFlag(i));
+            assert(mapped.GetChildCount(i) == flat.GetChildCount(i));
+            for (uint32_t c = 0; c < flat.GetChildCount(i); ++c) {
+                assert(mapped.GetChild(i, c) == flat.GetChild(i, c));
+            }
+            assert((mapped.GetValue(i) == nullptr) == (flat.GetValue(i) == nullptr));
+            assert(mapped.GetValue(i) == nullptr || strcmp(mapped.GetValue(i), flat.GetValue(i)) == 0);
+        }
+        for (size_t i = 0; i < roots.size(); i += 997) {
+            GSP::AstSearchCondition *condition = mapped.ToExpr(file.GetRoot(i));
+            assert(value1(condition) == value2(flat, roots[i]));
+            delete (condition);
+        }
+        file.Close();
+
+        /* a root past the nodes, as a corrupt file might have, fails Open() instead of the reads after it */
+        FILE *f = fopen(path.c_str(), "r+b");
+        uint32_t corrupt = flat.Size() + 7;
+        fseek(f, 32, SEEK_SET);
+        fwrite(&corrupt, sizeof(corrupt), 1, f);
+        fclose(f);
+        opened = file.Open(path.c_str());
+        assert(!opened && file.GetRootCount() == 0);
+
+        /* so does a node whose kind does not match its children or value: an AND turned NOT, a number turned NULL */
+        uint32_t children = 0, binary = GSP::FlatAst::NIL, number = GSP::FlatAst::NIL;
+        for (uint32_t i = 0; i < flat.Size(); ++i) {
+            children += flat.GetChildCount(i);
+            if (binary == GSP::FlatAst::NIL && flat.GetKind(i) == GSP::AstExpr::AND) binary = i;
+            if (number == GSP::FlatAst::NIL && flat.GetKind(i) == GSP::AstExpr::C_NUMBER) number = i;
+        }
+        assert(binary != GSP::FlatAst::NIL && number != GSP::FlatAst::NIL);
+        long kinds = 32 + 4 * ((long)roots.size() + 2 * flat.Size() + 1 + children);
+        uint32_t corrupted[2] = { binary, number };
+        uint8_t corrupt_kind[2] = { GSP::AstExpr::NOT, GSP::AstExpr::C_NULL };
+        for (int i = 0; i < 2; ++i) {
+            saved = GSP::AstFile::Save(path.c_str(), flat, roots);
+            assert(saved && file.Open(path.c_str()));
+            file.Close();
+            f = fopen(path.c_str(), "r+b");
+            fseek(f, kinds + corrupted[i], SEEK_SET);
+            fwrite(&corrupt_kind[i], 1, 1, f);
+            fclose(f);
+            opened = file.Open(path.c_str());
+            assert(!opened && file.GetRootCount() == 0);
+        }
+        (void)saved;
+        (void)opened;
+        remove(path.c_str());
+    }
+
+    {
+        /* what has no relational algebra yet fails the translation instead of giving a wrong one */
+        const char *untranslated[][2] = {
+            { "SELECT a FROM t", "table reference not supported" },
+            { "SELECT a FROM (SELECT b FROM t) x", "table reference not supported" },
+            { "SELECT a FROM t, u", "table reference not supported" },
+            { "SELECT a FROM t CROSS JOIN u", "table reference not supported" },
+            { "SELECT a FROM t JOIN u ON t.x = u.x", "join with a condition not supported" },
+            { "SELECT a FROM t UNION ALL SELECT b FROM u", "table reference not supported" },
+        };
+        for (auto &it : untranslated) {
+            GSP::ILex *lex = GSP::make_lex(it[0]);
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::free_lex(lex);
+            assert(e._code == GSP::ParseException::SUCCESS);
+            GSP::TranslateException te;
+            assert(GSP::translate(stmt, &te) == nullptr && te._code == GSP::TranslateException::FAIL && te._detail == it[1]);
+            delete (stmt);
+        }
+    }
+
+    {
+        /* policies repeat the same predicates, interned they share one node */
+        GSP::ParseException e;
+        auto parse = [&e](const char *condition) {
+            GSP::ILex *lex = GSP::make_lex(condition);
+            lex->next();
+            GSP::AstSearchCondition *r = GSP::parse_search_condition(lex, &e);
+            GSP::free_lex(lex);
+            return r;
+        };
+        GSP::AstSearchCondition *a = parse("resource.spe.url = 'a' AND x IN (SELECT y FROM t WHERE z BETWEEN 1 AND 2)");
+        GSP::AstSearchCondition *b = parse("resource.spe.url='a' and x in (select y from t where z between 1 and 2)");
+        GSP::AstSearchCondition *c = parse("resource.spe.url = 'a' AND x IN (SELECT y FROM t WHERE z BETWEEN 1 AND 3)");
+        assert(GSP::ast_equal(a, b) && GSP::ast_hash(a) == GSP::ast_hash(b));
+        assert(!GSP::ast_equal(a, c) && GSP::ast_hash(a) != GSP::ast_hash(c));
+
+        GSP::ExprInterner interner;
+        GSP::AstExpr *ia = interner.Intern(a), *ib = interner.Intern(b), *ic = interner.Intern(c);
+        assert(ia == ib && ia != ic);
+        assert(GSP::ast_equal(ia, a) && interner.GetHash(ia) == GSP::ast_hash(a));
+        (void)ia;
+        (void)ib;
+        (void)ic;
+        delete (a);
+        delete (b);
+        delete (c);
+
+        const int n = 20000;
+        std::vector<GSP::AstSearchCondition*> policies;
+        for (int i = 0; i < n; ++i) {
+            char buf[128];
+            snprintf(buf, sizeof(buf), "resource.spe.url = '/api/v%d' AND (role = 'admin' OR user.id = %d)", i % 50, i % 400);
+            policies.push_back(parse(buf));
+        }
+        clock_t start = clock();
+        for (auto it : policies) interner.Intern(it);
+        printf("intern: %.3f us/condition, %d conditions to %zu nodes\n", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n, n, interner.GetSize());
+        for (auto it : policies) delete (it);
+    }
+
+    {
+        /* a TPC-DS style statement: the outer FROM joins derived tables full of nested subqueries */
+        std::string big = "SELECT d0.k FROM store_sales s";
+        for (int i = 0; i < 20; ++i) {
+            std::string inner = "SELECT k FROM item WHERE i_price > (SELECT i_avg_price FROM item_stats WHERE i_category = 'c')";
+            for (int j = 0; j < 4; ++j) {
+                inner = "SELECT k, cs_quantity FROM catalog_sales c WHERE c.k IN (" + inner + ") AND EXISTS (SELECT 1 FROM "
+                        "date_dim d WHERE d.d_date_sk = c.cs_sold_date_sk AND d.d_year = 2000)";
+            }
+            big += " JOIN (" + inner + ") d" + std::to_string(i) + " ON s.k = d" + std::to_string(i) + ".k";
+        }
+        auto parse = [&big](bool lazy) {
+            GSP::ILex *lex = GSP::make_lex(big.c_str());
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *r = lazy ? GSP::parse_select_stmt_lazy(lex, &e) : GSP::parse_select_stmt(lex, &e);
+            assert(e._code == GSP::ParseException::SUCCESS && lex->token()->type() == GSP::END_P);
+            GSP::free_lex(lex);
+            return r;
+        };
+        /* the outer level only, the derived tables are not looked into */
+        auto outer_tables = [](GSP::AstSelectStmt *stmt) {
+            int count = 0;
+            GSP::AstTableRef *tr = static_cast<GSP::AstQueryPrimary*>(stmt->GetBody())->GetFrom()[0];
+            while (tr->GetTableRefType() != GSP::AstTableRef::RELATION && tr->GetTableRefType() != GSP::AstTableRef::SUBQUERY) {
+                tr = static_cast<GSP::AstTableJoin*>(tr)->GetLeft();
+                ++count;
+            }
+            return count + 1;
+        };
+        GSP::AstSelectStmt *full = parse(false), *lazy = parse(true);
+        assert(outer_tables(full) == 21 && outer_tables(lazy) == 21);
+        /* reading a derived table parses nothing, its Parse() does and the same tree comes out */
+        assert(!GSP::ast_equal(full, lazy));
+        GSP::AstTableRef *tr = static_cast<GSP::AstQueryPrimary*>(lazy->GetBody())->GetFrom()[0];
+        while (tr->GetTableRefType() != GSP::AstTableRef::RELATION) {
+            GSP::AstSelectStmt *derived = static_cast<GSP::AstSubQueryTableRef*>(static_cast<GSP::AstTableJoin*>(tr)->GetRight())->GetQuery();
+            assert(!derived->IsParsed() && derived->GetBody() == nullptr);
+            GSP::ParseException e;
+            bool parsed = derived->Parse(&e, true);
+            assert(parsed && derived->IsParsed());
+            (void)parsed;
+            tr = static_cast<GSP::AstTableJoin*>(tr)->GetLeft();
+        }
+        assert(GSP::ast_equal(full, lazy));
+        delete (full);
+        delete (lazy);
+
+        /* a bad subquery is found by its Parse(), the statement around it stays readable; both lexers skip alike */
+        for (int m = 0; m < 2; ++m) {
+            GSP::LexMode mode = m == 0 ? GSP::LEX_STREAM : GSP::LEX_TOKENIZED;
+            GSP::ILex *lex = GSP::make_lex("SELECT a FROM t WHERE a IN (SELECT FROM u) AND EXISTS (SELECT 1 FROM v)", mode);
+            lex->next();
+            GSP::ParseException e;
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt_lazy(lex, &e);
+            GSP::free_lex(lex);
+            assert(e._code == GSP::ParseException::SUCCESS);
+            GSP::AstInExpr *in = static_cast<GSP::AstInExpr*>(static_cast<GSP::AstBinaryOpExpr*>(
+                static_cast<GSP::AstQueryPrimary*>(stmt->GetBody())->GetWhere())->GetLeft());
+            assert(in->GetIn()->GetExprType() == GSP::AstExpr::EXPR_SUBQUERY);
+            GSP::AstSelectStmt *bad = static_cast<GSP::AstSubqueryExpr*>(in->GetIn())->GetQuery();
+            assert(bad->GetBody() == nullptr && !bad->Parse(&e) && e._code == GSP::ParseException::FAIL && !bad->IsParsed());
+            assert(e.GetDetail(bad->GetSql()).compare(0, 23, "UNEXPECT FROM at(0,11) ") == 0);
+            (void)bad;
+            delete (stmt);
+
+            lex = GSP::make_lex("SELECT a FROM t WHERE a IN (SELECT b ! c FROM u)", mode);
+            lex->next();
+            GSP::ParseException skipped;
+            stmt = GSP::parse_select_stmt_lazy(lex, &skipped);
+            GSP::free_lex(lex);
+            assert(stmt == nullptr && skipped._code == GSP::ParseException::FAIL);
+        }
+
+        const int n = 200;
+        for (int lazy_mode = 0; lazy_mode < 2; ++lazy_mode) {
+            clock_t start = clock();
+            for (int i = 0; i < n; ++i) {
+                GSP::AstSelectStmt *stmt = parse(lazy_mode != 0);
+                outer_tables(stmt);
+                delete (stmt);
+            }
+            printf("%s outer tables: %.3f us/statement\n", lazy_mode ? "lazy" : "full", (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n);
+        }
     }
 
     sql = "select cou1nt(*) \n"
@@ -568,6 +1105,110 @@ int main() {
           " group by i_brand, i_brand_id,t_hour,t_minute\n"
           " order by ext_price desc, i_brand_id\n"
           " ;";
+
+    {
+        /* relations for routing, from the tokens alone */
+        GSP::ParseException e;
+        std::vector<GSP::TableRefName> refs = GSP::table_refs(
+                "WITH a AS (SELECT * FROM a), b AS (SELECT * FROM a) SELECT * FROM b JOIN s.c AS cc ON 1=1 "
+                "WHERE x IN (SELECT y FROM (SELECT z FROM d) dd)", &e);
+        assert(e._code == GSP::ParseException::SUCCESS && refs.size() == 5);
+        assert(refs[0].name == "a" && !refs[0].cte && refs[0].depth == 1);     /* not yet in scope */
+        assert(refs[1].name == "a" && refs[1].cte);
+        assert(refs[2].name == "b" && refs[2].cte && refs[2].depth == 0);
+        assert(refs[3].name == "s.c" && refs[3].alias == "cc" && !refs[3].cte);
+        assert(refs[4].name == "d" && refs[4].depth == 2);
+
+        /* what it replaces: the tree, then a walk over it */
+        std::vector<std::string> names;
+        GSP::FlatAst flat;
+        const int n = 20000;
+        clock_t start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            GSP::AstSelectStmt *stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::free_lex(lex);
+            flat.Clear();
+            flat.Append(stmt);
+            names.clear();
+            GSP::flat_table_names(flat, &names);
+            delete (stmt);
+        }
+        double walked = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        /* the cheapest tree there is, built in a scratch arena straight into the flat form */
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            flat.Clear();
+            GSP::parse_select_stmt(lex, &e, &flat);
+            GSP::free_lex(lex);
+            names.clear();
+            GSP::flat_table_names(flat, &names);
+        }
+        double flattened = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        start = clock();
+        for (int i = 0; i < n; ++i) {
+            refs = GSP::table_refs(sql.c_str(), &e);
+        }
+        double scanned = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / n;
+        assert(refs.size() == names.size());
+        for (size_t i = 0; i < names.size(); ++i) {
+            assert(refs[i].name == names[i]);
+        }
+        printf("table refs: %.3f us/statement, parse and walk %.3f us, flat %.3f us\n", scanned, walked, flattened);
+    }
+
+    {
+        /* what one parse costs in memory, and what the tree keeps */
+        GSP::ParseException e;
+        GSP::MemoryStats heap, arena_stats, tokenized;
+        GSP::AstSelectStmt *stmt;
+        {
+            GSP::MemoryScope scope(&heap);
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::free_lex(lex);
+        }
+        assert(e._code == GSP::ParseException::SUCCESS);
+        assert(heap._lex.live == 0 && heap._lex.bytes == sql.length() + 1);
+        assert(heap._ast.live > 0 && heap._ast.live <= heap._ast.bytes && heap._peak >= heap._ast.live);
+        size_t retained = heap._ast.live;
+        delete (stmt);      /* a free goes to the stats that counted the allocation, current or not */
+        assert(heap._ast.live == 0);
+        {
+            /* and to no stats when none counted it, live does not wrap below zero */
+            GSP::ILex *lex = GSP::make_lex(sql.c_str());
+            lex->next();
+            stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::MemoryStats other;
+            GSP::MemoryScope scope(&other);
+            GSP::free_lex(lex);
+            delete (stmt);
+            assert(other._ast.live == 0 && other._lex.live == 0 && other._ast.allocs == 0);
+        }
+        {
+            GSP::Arena arena;
+            GSP::ArenaScope arena_scope(&arena);
+            GSP::MemoryScope scope(&arena_stats);
+            GSP::ILex *lex = GSP::make_lex(sql.c_str(), GSP::LEX_TOKENIZED);
+            lex->next();
+            stmt = GSP::parse_select_stmt(lex, &e);
+            GSP::free_lex(lex);
+            assert(arena_stats._ast.bytes == heap._ast.bytes && arena_stats._ast.live == arena_stats._ast.bytes);
+            assert(arena.GetUsed() >= arena_stats._ast.bytes);
+        }
+        {
+            GSP::MemoryScope scope(&tokenized);
+            GSP::ILex *lex = GSP::make_lex(sql.c_str(), GSP::LEX_TOKENIZED);
+            GSP::free_lex(lex);
+        }
+        assert(tokenized._lex.live == 0 && tokenized._lex.bytes > sql.length() + 1);
+        printf("memory: %zu allocations, %zu bytes, peak %zu, retained %zu; tokens %zu bytes\n", heap._ast.allocs + heap._lex.allocs,
+               heap._ast.bytes + heap._lex.bytes, heap._peak, retained, tokenized._lex.peak);
+    }
     sql = "SELECT 5-1 FROM dummy";
     clock_t start = clock();
     for (int i = 0; i < 1; ++i) {
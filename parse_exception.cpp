@@ -12,6 +12,7 @@ namespace GSP {
             case BETWEEN:           return "BETWEEN";
             case BY:                return "BY";
             case CASE:              return "CASE";
+            case END_P:             return "END OF STATEMENT";
             case FALSE:             return "FALSE";
             case ID:                return "IDENTIFIER";
             case IN:                return "IN";
@@ -34,40 +35,44 @@ namespace GSP {
         }
     }
 
-    std::string tokens2str(const std::vector<TokenType >& expects) {
-        std::string r;
-        int i = 0;
-        for (auto it : expects) {
-            if (i == 0) r += token2str(it);
-            else r += (" | " + token2str(it));
-            ++i;
-        }
-        return r;
+    void ParseException::SetFail(TokenType expect, ILex *lex) {
+        SetFail({expect}, lex);
     }
 
-    void ParseException::SetFail(TokenType expect, ILex *lex) {
+    void ParseException::SetFail(std::initializer_list<TokenType> expects, ILex *lex) {
+        assert(expects.size() <= MAX_EXPECTS);
         _code = FAIL;
-        //"UNEXPECT %s at %d,%d EXPECT %s";
-        _detail = "UNEXPECT ";
-        _detail += lex->token()->word();
-        _detail += " at";
-        _detail += "(" + std::to_string(lex->cur_pos_line()) + "," + std::to_string(lex->cur_pos_col()) + ") ";
-        _detail += "EXPECT " + token2str(expect);
+        _line = lex->cur_pos_line();
+        _col = lex->cur_pos_col();
+        _offset = lex->token()->offset();
+        _length = lex->token()->length();
+        _message = lex->token()->message();
+        _expect_count = 0;
+        for (auto it : expects) {
+            _expects[_expect_count++] = it;
+        }
     }
 
-    void ParseException::SetFail(const std::vector<TokenType >& expects, ILex *lex) {
-        _code = FAIL;
-        //"UNEXPECT %s at %d,%d EXPECT %s";
-        _detail = "UNEXPECT ";
-        _detail += lex->token()->word();
-        _detail += " at";
-        _detail += "(" + std::to_string(lex->cur_pos_line()) + "," + std::to_string(lex->cur_pos_col()) + ") ";
-        _detail += "EXPECT " + tokens2str(expects);
+    std::string ParseException::GetDetail(const char *sql) const {
+        if (_code == SUCCESS) {
+            return "";
+        }
+        std::string r = "UNEXPECT ";
+        if (_message != nullptr) {
+            r += _message;
+        }
+        r.append(sql + _offset, _length);
+        r += " at(" + std::to_string(_line) + "," + std::to_string(_col) + ") EXPECT ";
+        for (unsigned int i = 0; i < _expect_count; ++i) {
+            if (i > 0) r += " | ";
+            r += token2str(_expects[i]);
+        }
+        return r;
     }
 
-    std::vector<AstId*> parse_ids(ILex *lex, ParseException *e, TokenType separator/* = COMMA */) {
+    AstVector<AstId*> parse_ids(ILex *lex, ParseException *e, TokenType separator/* = COMMA */) {
         assert( separator == COMMA || separator == DOT);
-        std::vector<AstId*> ids;
+        AstVector<AstId*> ids;
         AstId *id = parse_id(lex, e);
         if (e->_code != ParseException::SUCCESS) {
             return ids;
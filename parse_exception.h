@@ -3,19 +3,34 @@
 
 #include <string>
 #include <vector>
+#include <initializer_list>
 #include "lex.h"
+#include "arena.h"
 
 namespace GSP {
     struct ParseException {
         void SetFail(TokenType expect, ILex *lex);
-        void SetFail(const std::vector<TokenType >& expects, ILex *lex);
+        void SetFail(std::initializer_list<TokenType> expects, ILex *lex);
+        /*
+         * "UNEXPECT <token> at(<line>,<col>) EXPECT <tokens>", rendered from the record below on each call.
+         * sql is the text that was parsed, the token is sliced from it
+         */
+        std::string GetDetail(const char *sql) const;
         enum { SUCCESS, FAIL } _code = SUCCESS;
-        std::string _detail;
+        /* the failure as recorded, nothing is formatted when failing */
+        enum { MAX_EXPECTS = 12 };
+        unsigned int    _line = 0;
+        unsigned int    _col = 0;
+        unsigned int    _offset = 0;            /* the unexpected token is [_offset, _offset + _length) of the sql */
+        unsigned int    _length = 0;
+        const char     *_message = nullptr;     /* of an ERR token */
+        unsigned int    _expect_count = 0;
+        TokenType       _expects[MAX_EXPECTS];
     };
 
     class AstId;
 
-    std::vector<AstId*>         parse_ids                   (ILex *lex, ParseException *e, TokenType separator = COMMA);
+    AstVector<AstId*>           parse_ids                   (ILex *lex, ParseException *e, TokenType separator = COMMA);
     AstId                      *parse_id                    (ILex *lex, ParseException *e);
 
 }
@@ -4,6 +4,7 @@
 #include "parse_exception.h"
 #include "parse_select_stmt.h"
 #include "sql_select_stmt.h"
+#include "arena.h"
 #include "assert.h"
 
 
@@ -42,6 +43,11 @@ namespace GSP {
         return term;
     }
 
+    AstSearchCondition *parse_search_condition(ILex *lex, ParseException *e, Arena *arena) {
+        ArenaScope scope(arena);
+        return parse_search_condition(lex, e);
+    }
+
     AstSearchCondition *parse_boolean_term(ILex *lex, ParseException *e) {
         AstSearchCondition *factor = parse_boolean_factor(lex, e);
         if (e->_code != ParseException::SUCCESS) {
@@ -160,7 +166,7 @@ namespace GSP {
                 return nullptr;
             }
             lex->next();
-            AstSelectStmt *stmt = parse_select_stmt(lex, e);
+            AstSelectStmt *stmt = parse_subquery(lex, e);
             if (e->_code != ParseException::SUCCESS) {
                 return nullptr;
             }
@@ -191,7 +197,8 @@ namespace GSP {
                         delete (row_expr);
                         return nullptr;
                     }
-                    AstSelectStmt *stmt = parse_select_stmt(lex, e);
+                    lex->next();
+                    AstSelectStmt *stmt = parse_subquery(lex, e);
                     if (e->_code != ParseException::SUCCESS) {
                         delete (row_expr);
                         return nullptr;
@@ -202,6 +209,7 @@ namespace GSP {
                         e->SetFail(RPAREN, lex);
                         return nullptr;
                     }
+                    lex->next();
                     AstQuantifiedCompareExpr *r = new AstQuantifiedCompareExpr(expr_type, row_expr, stmt);
                     return r;
                 }
@@ -391,9 +399,9 @@ namespace GSP {
                 if (e->_code != ParseException::SUCCESS) {
                     return nullptr;
                 }
-                AstColumnRef *col_ref = dynamic_cast<AstColumnRef*>(m);
+                AstColumnRef *col_ref = static_cast<AstColumnRef*>(m);
                 if (!col_ref->IsWild() && lex->token()->type() == LPAREN) {
-                    std::vector<AstId*> ids= col_ref->GetColumn();
+                    AstIds ids= col_ref->GetColumn();
                     col_ref->SetColumn({}, false);
                     delete (col_ref);
                     lex->next();
@@ -417,33 +425,50 @@ namespace GSP {
             }
         }
         else if (tk1 == LPAREN) {
+            /*
+             * decided by the next token, no backtracking: SELECT/WITH open a subquery, anything else an
+             * expression list. A '(' may also open a parenthesized query, e.g. ((SELECT 1) UNION SELECT 2),
+             * which is only known once the subquery it starts with is followed by a set operator.
+             */
             lex->next();
-            ILex *lex_c = lex->clone();
-            AstSelectStmt *stmt = nullptr;
-            AstExprList *expr_list = nullptr;
-            stmt = parse_select_stmt(lex_c, e);
-            if (e->_code == ParseException::SUCCESS && lex_c->token()->type() == RPAREN) {
-                lex_c->next();
-                lex->recover(lex_c);
-                delete (lex_c);
-                return new AstSubqueryExpr(stmt);
-            } else {    /* backtrack */
-                if (e->_code == ParseException::SUCCESS && lex_c->token()->type() != RPAREN) {
-                    e->SetFail(RPAREN, lex_c);
+            tk1 = lex->token()->type();
+            if (tk1 == SELECT || tk1 == WITH) {
+                AstSelectStmt *stmt = parse_subquery(lex, e);
+                if (e->_code != ParseException::SUCCESS) {
+                    return nullptr;
                 }
-                auto pos = lex_c->cur_pos();
-                ParseException e1 = *e;
-                e->_code = ParseException::SUCCESS; e->_detail = "";
-                expr_list = parse_expr_list(lex, e);
+                if (lex->token()->type() != RPAREN) {
+                    delete (stmt);
+                    e->SetFail(RPAREN, lex);
+                    return nullptr;
+                }
+                lex->next();
+                return new AstSubqueryExpr(stmt);
+            }
+            else {
+                AstExprList *expr_list = parse_expr_list(lex, e);
                 if (e->_code != ParseException::SUCCESS) {
-                    if (lex->cur_pos() < pos) {
-                        *e = e1;
-                        lex->recover(lex_c);
-                    }
-                    delete (lex_c);
                     return nullptr;
                 }
-                delete (lex_c);
+                auto tkp = lex->token()->type();
+                if ((tkp == UNION || tkp == EXCEPT || tkp == INTERSECT || tkp == ORDER) &&
+                        expr_list->GetExprs().size() == 1 &&
+                        expr_list->GetExprs()[0]->GetExprType() == AstRowExpr::EXPR_SUBQUERY) {
+                    AstSubqueryExpr *first = static_cast<AstSubqueryExpr*>(expr_list->GetExprs()[0]);
+                    AstSelectStmt *stmt = parse_select_stmt_rest(lex, e, first->GetQuery());
+                    first->SetQuery(nullptr);
+                    delete (expr_list);
+                    if (e->_code != ParseException::SUCCESS) {
+                        return nullptr;
+                    }
+                    if (lex->token()->type() != RPAREN) {
+                        delete (stmt);
+                        e->SetFail(RPAREN, lex);
+                        return nullptr;
+                    }
+                    lex->next();
+                    return new AstSubqueryExpr(stmt);
+                }
                 if (lex->token()->type() != RPAREN) {
                     delete (expr_list);
                     e->SetFail(RPAREN, lex);
@@ -451,7 +476,7 @@ namespace GSP {
                 }
                 lex->next();
                 AstRowExpr *r = nullptr;
-                std::vector<AstSearchCondition*> scs = expr_list->GetExprs();
+                AstExprs scs = expr_list->GetExprs();
                 assert(scs.size() > 0);
                 if (scs.size() == 1) {
                     r = scs[0];
@@ -508,7 +533,7 @@ namespace GSP {
             return new AstColumnRef({}, true);
         }
 
-        std::vector<AstId*> ids;
+        AstIds ids;
         AstId *id = parse_id(lex, e);
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
@@ -535,7 +560,7 @@ namespace GSP {
     }
 
     AstExprList *parse_expr_list(ILex *lex, ParseException *e) {
-        std::vector<AstSearchCondition*> exprs;
+        AstExprs exprs;
         AstSearchCondition *expr = parse_search_condition(lex, e);
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
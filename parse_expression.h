@@ -8,8 +8,11 @@ namespace GSP {
     typedef AstExpr                             AstSearchCondition;
     typedef AstExpr                             AstRowExpr;
     class AstExprList;
+    class Arena;
 
     AstSearchCondition      *parse_search_condition(ILex *lex, ParseException *e);
+    /* the tree is allocated in arena, see parse_select_stmt */
+    AstSearchCondition      *parse_search_condition(ILex *lex, ParseException *e, Arena *arena);
 
     AstRowExpr              *parse_row_expr(ILex *lex, ParseException *e);
 
@@ -0,0 +1,121 @@
+#include "parse_script.h"
+#include "parse_select_stmt.h"
+#include "sql_select_stmt.h"
+#include "arena.h"
+#include "lex.h"
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace GSP {
+
+    Script::~Script() {
+        /* the statements were allocated in the arenas */
+        for (auto it : _arenas) delete (it);
+        _arenas.clear();
+        _stmts.clear();
+    }
+
+    /* skip a literal or a quoted identifier starting at i, a doubled close char is part of it */
+    static size_t skip_quoted(const char *sql, size_t i, char close) {
+        for (++i; sql[i] != '\0'; ++i) {
+            if (sql[i] == close) {
+                if (sql[i + 1] != close) return i + 1;
+                ++i;
+            }
+        }
+        return i;
+    }
+
+    std::vector<ScriptStmt> split_script(const char *sql) {
+        std::vector<ScriptStmt> stmts;
+        size_t start = 0;
+        bool empty = true;
+        for (size_t i = 0;;) {
+            char c = sql[i];
+            if (c == '\0' || c == ';') {
+                if (!empty) {
+                    ScriptStmt s;
+                    s.offset = start;
+                    s.length = i - start;
+                    s.stmt = nullptr;
+                    stmts.push_back(s);
+                }
+                if (c == '\0') break;
+                empty = true;
+                ++i;
+                continue;
+            }
+            if (c == '-' && sql[i + 1] == '-') {
+                for (i += 2; sql[i] != '\0' && sql[i] != '\n'; ++i) {}
+                continue;
+            }
+            if (c == '/' && sql[i + 1] == '*') {
+                for (i += 2; sql[i] != '\0' && !(sql[i] == '*' && sql[i + 1] == '/'); ++i) {}
+                if (sql[i] != '\0') i += 2;
+                continue;
+            }
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f') {
+                ++i;
+                continue;
+            }
+            if (empty) {
+                start = i;
+                empty = false;
+            }
+            if (c == '\'') i = skip_quoted(sql, i, '\'');
+            else if (c == '"') i = skip_quoted(sql, i, '"');
+            else if (c == '[') i = skip_quoted(sql, i, ']');
+            else ++i;
+        }
+        return stmts;
+    }
+
+    static void parse_script_stmts(const char *sql, std::vector<ScriptStmt> *stmts, std::atomic<size_t> *next, Arena *arena) {
+        const size_t chunk = 8;     /* statements taken at a time */
+        for (;;) {
+            size_t begin = next->fetch_add(chunk);
+            if (begin >= stmts->size()) {
+                break;
+            }
+            size_t end = begin + chunk < stmts->size() ? begin + chunk : stmts->size();
+            for (size_t i = begin; i < end; ++i) {
+                ScriptStmt &s = (*stmts)[i];
+                std::string text(sql + s.offset, s.length);
+                ILex *lex = make_lex(text.c_str());
+                lex->next();
+                s.stmt = parse_select_stmt(lex, &s.e, arena);
+                if (s.e._code == ParseException::SUCCESS && lex->token()->type() != END_P) {
+                    s.stmt = nullptr;   /* left in the arena */
+                    s.e.SetFail(END_P, lex);
+                }
+                free_lex(lex);
+            }
+        }
+    }
+
+    Script *parse_script(const char *sql, unsigned int workers) {
+        Script *script = new Script;
+        script->_stmts = split_script(sql);
+        if (workers == 0) {
+            workers = std::thread::hardware_concurrency();
+        }
+        if (workers > script->_stmts.size()) {
+            workers = script->_stmts.size();
+        }
+        if (workers == 0) {
+            workers = 1;
+        }
+        for (unsigned int i = 0; i < workers; ++i) {
+            script->_arenas.push_back(new Arena(64 * 1024));
+        }
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < workers; ++i) {
+            threads.push_back(std::thread(parse_script_stmts, sql, &script->_stmts, &next, script->_arenas[i]));
+        }
+        parse_script_stmts(sql, &script->_stmts, &next, script->_arenas[0]);
+        for (auto &it : threads) it.join();
+        return script;
+    }
+}
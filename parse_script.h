@@ -0,0 +1,39 @@
+#ifndef GSP_PARSE_SCRIPT_H
+#define GSP_PARSE_SCRIPT_H
+
+#include <vector>
+#include "parse_exception.h"
+
+namespace GSP {
+    class AstSelectStmt;
+    class Arena;
+
+    struct ScriptStmt {
+        unsigned int        offset;     /* the statement is [offset, offset + length) of the script, without the ; */
+        unsigned int        length;
+        AstSelectStmt      *stmt;       /* null means it failed, see e. positions in e are relative to offset */
+        ParseException      e;
+    };
+
+    /* the statements of a script in input order, their trees live in the script's arenas */
+    class Script {
+    public:
+        Script() {}
+        ~Script();
+        const std::vector<ScriptStmt>& GetStmts() { return _stmts; }
+    private:
+        Script(const Script&) = delete;
+        Script& operator=(const Script&) = delete;
+        std::vector<ScriptStmt>     _stmts;
+        std::vector<Arena*>         _arenas;    /* one per worker */
+        friend Script *parse_script(const char *sql, unsigned int workers);
+    };
+
+    /* split sql at the ; outside of literals and comments, empty statements are skipped */
+    std::vector<ScriptStmt>     split_script    (const char *sql);
+
+    /* parse every statement of sql on workers threads, 0 means one per core */
+    Script                     *parse_script    (const char *sql, unsigned int workers = 0);
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include "sql_table_ref.h"
 #include "parse_exception.h"
 #include "lex.h"
+#include "arena.h"
 
 namespace GSP {
 
@@ -14,8 +15,12 @@ namespace GSP {
     AstOrderByItem          *parse_order_by_item            (ILex *lex, ParseException *e);
     AstWithClause           *parse_with_clause              (ILex *lex, ParseException *e);
 
+    AstSelectStmt           *parse_order_by                 (ILex *lex, ParseException *e, AstSelectStmt *select_stmt);
+
     AstQueryExpressionBody  *parse_query_expression_body    (ILex *lex, ParseException *e);
+    AstQueryExpressionBody  *parse_query_expression_body_rest(ILex *lex, ParseException *e, AstQueryExpressionBody *query_term);
     AstQueryExpressionBody  *parse_query_term               (ILex *lex, ParseException *e);
+    AstQueryExpressionBody  *parse_query_term_rest          (ILex *lex, ParseException *e, AstQueryExpressionBody *primary);
     AstQueryExpressionBody  *parse_query_primary            (ILex *lex, ParseException *e);
 
     AstProjections                      parse_projection_list           (ILex *lex, ParseException *e);
@@ -30,9 +35,73 @@ namespace GSP {
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
         }
+        return parse_order_by(lex, e, select_stmt);
+    }
+
+    AstSelectStmt *parse_select_stmt(ILex *lex, ParseException *e, Arena *arena) {
+        ArenaScope scope(arena);
+        return parse_select_stmt(lex, e);
+    }
+
+    /* set while parse_select_stmt_lazy runs lazily, its subqueries are skipped */
+    static thread_local bool t_lazy = false;
+
+    AstSelectStmt *parse_select_stmt_lazy(ILex *lex, ParseException *e, bool lazy) {
+        bool prev = t_lazy;
+        t_lazy = lazy;
+        AstSelectStmt *r = parse_select_stmt(lex, e);
+        t_lazy = prev;
+        return r;
+    }
+
+    AstSelectStmt *parse_subquery(ILex *lex, ParseException *e) {
+        if (!t_lazy) {
+            return parse_select_stmt(lex, e);
+        }
+        unsigned int start = lex->token()->offset();
+        if (!lex->skip_parens()) {
+            e->SetFail(RPAREN, lex);
+            return nullptr;
+        }
+        return new AstSelectStmt(lex->text() + start, lex->token()->offset() - start);
+    }
+
+    AstSelectStmt *parse_select_stmt_rest(ILex *lex, ParseException *e, AstSelectStmt *first) {
+        auto tkp = lex->token()->type();
+        if ((tkp == UNION || tkp == EXCEPT || tkp == INTERSECT || tkp == ORDER) && !first->Parse(e)) {
+            /* a lazy first is added to */
+            delete (first);
+            return nullptr;
+        }
+        if ((tkp == UNION || tkp == EXCEPT || tkp == INTERSECT || tkp == ORDER) &&
+                (first->GetWithClause() != nullptr || first->GetOrderByItems().size() > 0)) {
+            /* a query primary has neither */
+            delete (first);
+            e->SetFail(RPAREN, lex);
+            return nullptr;
+        }
+        if (tkp != UNION && tkp != EXCEPT && tkp != INTERSECT) {
+            return parse_order_by(lex, e, first);
+        }
+        AstQueryExpressionBody *primary = first->GetBody();
+        first->SetBody(nullptr);
+        delete (first);
+        AstQueryExpressionBody *query_term = parse_query_term_rest(lex, e, primary);
+        if (e->_code != ParseException::SUCCESS) {
+            return nullptr;
+        }
+        AstQueryExpressionBody *body = parse_query_expression_body_rest(lex, e, query_term);
+        if (e->_code != ParseException::SUCCESS) {
+            return nullptr;
+        }
+        return parse_order_by(lex, e, new AstSelectStmt(nullptr, body, {}));
+    }
+
+    AstSelectStmt *parse_order_by(ILex *lex, ParseException *e, AstSelectStmt *select_stmt) {
         if (lex->token()->type() == ORDER) {
             lex->next();
             if (lex->token()->type() != BY) {
+                delete (select_stmt);
                 e->SetFail(BY, lex);
                 return nullptr;
             }
@@ -103,7 +172,10 @@ namespace GSP {
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
         }
+        return parse_query_expression_body_rest(lex, e, query_term);
+    }
 
+    AstQueryExpressionBody *parse_query_expression_body_rest(ILex *lex, ParseException *e, AstQueryExpressionBody *query_term) {
         auto tkp = lex->token()->type();
         for (; tkp == UNION || tkp == EXCEPT; tkp = lex->token()->type()) {
             lex->next();
@@ -129,6 +201,10 @@ namespace GSP {
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
         }
+        return parse_query_term_rest(lex, e, primary);
+    }
+
+    AstQueryExpressionBody *parse_query_term_rest(ILex *lex, ParseException *e, AstQueryExpressionBody *primary) {
         TokenType tkp = lex->token()->type();
         for (; tkp == INTERSECT; tkp = lex->token()->type()) {
             lex->next();
@@ -348,8 +424,8 @@ namespace GSP {
         }
         AstProjection *proj = new AstProjection(row_expr, nullptr);
         if (row_expr->GetExprType() == AstRowExpr::EXPR_COLUMN_REF &&
-            dynamic_cast<AstColumnRef*>(row_expr)->GetColumn().size() == 0 &&
-            dynamic_cast<AstColumnRef*>(row_expr)->IsWild()) /* here means only * */ {
+            static_cast<AstColumnRef*>(row_expr)->GetColumn().size() == 0 &&
+            static_cast<AstColumnRef*>(row_expr)->IsWild()) /* here means only * */ {
             return proj;
         }
         if (lex->token()->type() == AS) {
@@ -6,8 +6,25 @@ namespace GSP {
     class AstSelectStmt;
 
     class ParseException;
+    class Arena;
 
     AstSelectStmt *parse_select_stmt(ILex *lex, ParseException *e);
+
+    /* build the whole tree in arena, free it with the arena instead of deleting the result */
+    AstSelectStmt *parse_select_stmt(ILex *lex, ParseException *e, Arena *arena);
+
+    /*
+     * only the outer query is parsed, each subquery is delimited by its parentheses and kept as text
+     * in a lazy AstSelectStmt until its Parse(). errors inside subqueries surface then. with lazy
+     * false nothing is skipped, also when called while a lazy parse runs.
+     */
+    AstSelectStmt *parse_select_stmt_lazy(ILex *lex, ParseException *e, bool lazy = true);
+
+    /* the query in an already consumed left paren, up to its right paren. lazy inside parse_select_stmt_lazy */
+    AstSelectStmt *parse_subquery(ILex *lex, ParseException *e);
+
+    /* continue a select stmt whose leftmost query primary, first, was a parenthesized query already parsed */
+    AstSelectStmt *parse_select_stmt_rest(ILex *lex, ParseException *e, AstSelectStmt *first);
 }
 
 #endif
\ No newline at end of file
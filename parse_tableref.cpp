@@ -11,9 +11,10 @@ namespace GSP {
 
     AstTableRef                  *parse_table_primary(ILex *lex, ParseException *e);
     AstTableRef::TABLE_REF_TYPE   parse_join_type(ILex *lex, ParseException *e);
+    AstTableRef                  *parse_tabelref_rest(ILex *lex, ParseException *e, AstTableRef *tr);
 
-    std::vector<AstTableRef*> parse_tableref_list(ILex *lex, ParseException *e) {
-        std::vector<AstTableRef*> tablerefs;
+    AstTableRefs parse_tableref_list(ILex *lex, ParseException *e) {
+        AstTableRefs tablerefs;
         AstTableRef *tableref = parse_tabelref(lex, e);
         if (e->_code != ParseException::SUCCESS) {
             return tablerefs;
@@ -119,6 +120,10 @@ namespace GSP {
         if (e->_code != ParseException::SUCCESS) {
             return nullptr;
         }
+        return parse_tabelref_rest(lex, e, tr);
+    }
+
+    AstTableRef *parse_tabelref_rest(ILex *lex, ParseException *e, AstTableRef *tr) {
         for (; has_join(lex->token()->type());) {
             AstTableRef *left = tr;
             AstTableRef::TABLE_REF_TYPE join = parse_join_type(lex, e);
@@ -153,70 +158,103 @@ namespace GSP {
         return tr;
     }
 
+    /* [ AS ] label [ ( simple_ident_list ) ] after the right paren of a derived table, takes stmt */
+    AstTableRef *parse_derived_table(ILex *lex, ParseException *e, AstSelectStmt *stmt) {
+        if (lex->token()->type() == AS) {
+            lex->next();
+        }
+        AstId *id = parse_id(lex, e);
+        if (e->_code != ParseException::SUCCESS) {
+            delete (stmt);
+            return nullptr;
+        }
+        AstIds cols;
+        if (lex->token()->type() == LPAREN) {
+            lex->next();
+            cols = parse_ids(lex, e);
+            if (e->_code != ParseException::SUCCESS) {
+                delete (stmt);
+                delete (id);
+                return nullptr;
+            }
+            if (lex->token()->type() != RPAREN) {
+                delete (stmt);
+                delete (id);
+                for (auto it : cols) delete (it);
+                e->SetFail(RPAREN, lex);
+                return nullptr;
+            }
+            lex->next();
+        }
+        return new AstSubQueryTableRef(stmt, id, cols);
+    }
+
+    /*
+     * the content of a parenthesized table primary, the left paren already consumed. it is either
+     * a query, handed back through stmt, or a joined table, returned. SELECT and WITH start a query,
+     * a nested left paren is parsed recursively and what follows its right paren decides: a set
+     * operator, ORDER or another right paren continue the query, anything else makes it a derived
+     * table that may be joined further. every token is consumed once.
+     */
+    AstTableRef *parse_parenthesized_table(ILex *lex, ParseException *e, AstSelectStmt **stmt) {
+        *stmt = nullptr;
+        auto tkp = lex->token()->type();
+        if (tkp == SELECT || tkp == WITH) {
+            *stmt = parse_subquery(lex, e);
+            return nullptr;
+        }
+        if (tkp != LPAREN) {
+            return parse_tabelref(lex, e);
+        }
+        lex->next();
+        AstSelectStmt *inner = nullptr;
+        AstTableRef *tr = parse_parenthesized_table(lex, e, &inner);
+        if (e->_code != ParseException::SUCCESS) {
+            return nullptr;
+        }
+        if (lex->token()->type() != RPAREN) {
+            delete (inner);
+            delete (tr);
+            e->SetFail(RPAREN, lex);
+            return nullptr;
+        }
+        lex->next();
+        if (inner != nullptr) {
+            tkp = lex->token()->type();
+            if (tkp == UNION || tkp == EXCEPT || tkp == INTERSECT || tkp == ORDER || tkp == RPAREN) {
+                *stmt = parse_select_stmt_rest(lex, e, inner);
+                return nullptr;
+            }
+            tr = parse_derived_table(lex, e, inner);
+            if (e->_code != ParseException::SUCCESS) {
+                return nullptr;
+            }
+        }
+        return parse_tabelref_rest(lex, e, tr);
+    }
+
     AstTableRef *parse_table_primary(ILex *lex, ParseException *e) {
         if (lex->token()->type() == LPAREN) {
             lex->next();
-            auto lex_c = lex->clone();
-            AstSelectStmt *stmt = parse_select_stmt(lex_c, e);
-            AstTableRef *tr = nullptr;
-            if (e->_code == ParseException::SUCCESS && lex_c->token()->type() == RPAREN) {
-                lex_c->next();
-                lex->recover(lex_c);
-                delete (lex_c);
-                if (lex->token()->type() == AS) {
-                    lex->next();
-                }
-                AstId *id = parse_id(lex, e);
-                if (e->_code != ParseException::SUCCESS) {
-                    delete (stmt);
-                    return nullptr;
-                }
-                std::vector<AstId*> cols;
-                if (lex->token()->type() == LPAREN) {
-                    lex->next();
-                    cols = parse_ids(lex, e);
-                    if (e->_code != ParseException::SUCCESS) {
-                        delete (stmt);
-                        delete (id);
-                        return nullptr;
-                    }
-                    if (lex->token()->type() != RPAREN) {
-                        delete (stmt);
-                        delete (id);
-                        e->SetFail(RPAREN, lex);
-                        return nullptr;
-                    }
-                    lex->next();
-                }
-                return new AstSubQueryTableRef(stmt, id, cols);
-            } else {        /* backtrack */
-                if (e->_code == ParseException::SUCCESS && lex_c->token()->type() != RPAREN) {
-                    e->SetFail(RPAREN, lex_c);
-                }
-                ParseException e1 = *e;
-                auto pos = lex_c->cur_pos();
-                e->_code = ParseException::SUCCESS; e->_detail = "";
-                tr = parse_tabelref(lex, e);
-                if (e->_code != ParseException::SUCCESS) {
-                    if (lex->cur_pos() < pos) {
-                        *e = e1;
-                        lex->recover(lex_c);
-                    }
-                    delete (lex_c);
-                    return nullptr;
-                }
-                delete (lex_c);
-                if (lex->token()->type() != RPAREN) {
-                    delete (tr);
-                    e->SetFail(RPAREN, lex);
-                    return nullptr;
-                }
-                lex->next();
-                return tr;
+            AstSelectStmt *stmt = nullptr;
+            AstTableRef *tr = parse_parenthesized_table(lex, e, &stmt);
+            if (e->_code != ParseException::SUCCESS) {
+                return nullptr;
+            }
+            if (lex->token()->type() != RPAREN) {
+                delete (stmt);
+                delete (tr);
+                e->SetFail(RPAREN, lex);
+                return nullptr;
+            }
+            lex->next();
+            if (stmt != nullptr) {
+                return parse_derived_table(lex, e, stmt);
             }
+            return tr;
         }
         else {
-            std::vector<AstId*> ids = parse_ids(lex, e, DOT);
+            AstIds ids = parse_ids(lex, e, DOT);
             if (e->_code != ParseException::SUCCESS) {
                 return nullptr;
             }
@@ -0,0 +1,505 @@
+#include "policy_program.h"
+#include "sql_expression.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+namespace GSP {
+
+    static bool is_compare(PolicyOpcode op) { return op >= OP_EQ && op <= OP_GE; }
+
+    /* the superinstructions that end in a jump, they come in threes after the plain one */
+    static bool is_fused_jump(PolicyOpcode op) { return op >= CMP_VAR_CONST_EQ && (op - CMP_VAR_CONST_EQ) % 3 != 0; }
+
+    class PolicyCompiler {
+    public:
+        PolicyCompiler(PolicyProgram *program, PolicyAttributes *attributes, PolicyException *e)
+            : _program(program), _attributes(attributes), _e(e) {
+            program->_attributes = attributes;
+        }
+
+        void Compile(AstSearchCondition *condition) {
+            if (_e->_code != PolicyException::SUCCESS) {
+                return;
+            }
+            switch (condition->GetExprType()) {
+                case AstExpr::OR:
+                case AstExpr::AND: {
+                    /* the left side decides alone when it is TRUE for OR, FALSE for AND; a jump leaves the stack as is */
+                    auto binary = static_cast<AstBinaryOpExpr*>(condition);
+                    Compile(binary->GetLeft());
+                    size_t jump = Emit(condition->GetExprType() == AstExpr::OR ? JUMP_IF_TRUE : JUMP_IF_FALSE, 0);
+                    Compile(binary->GetRight());
+                    Emit(condition->GetExprType() == AstExpr::OR ? OP_OR : OP_AND, 0);
+                    _program->_code[jump].arg = _program->_code.size();
+                } break;
+                case AstExpr::COMP_EQ: case AstExpr::COMP_NEQ:
+                case AstExpr::COMP_LT: case AstExpr::COMP_LE:
+                case AstExpr::COMP_GT: case AstExpr::COMP_GE: {
+                    auto binary = static_cast<AstBinaryOpExpr*>(condition);
+                    PolicyOpcode op;
+                    switch (condition->GetExprType()) {
+                        case AstExpr::COMP_EQ: op = OP_EQ; break;
+                        case AstExpr::COMP_NEQ: op = OP_NEQ; break;
+                        case AstExpr::COMP_LT: op = OP_LT; break;
+                        case AstExpr::COMP_LE: op = OP_LE; break;
+                        case AstExpr::COMP_GT: op = OP_GT; break;
+                        default: op = OP_GE; break;
+                    }
+                    if (op != OP_EQ && op != OP_NEQ &&
+                            (binary->GetLeft()->GetExprType() == AstExpr::C_STRING || binary->GetRight()->GetExprType() == AstExpr::C_STRING)) {
+                        Fail("strings only compare with = and <>");
+                        return;
+                    }
+                    Compile(binary->GetLeft());
+                    Compile(binary->GetRight());
+                    Emit(op, 0);
+                } break;
+                case AstExpr::EXPR_COLUMN_REF: {
+                    auto column = static_cast<AstColumnRef*>(condition);
+                    if (column->IsWild()) {
+                        Fail("* in a condition");
+                        return;
+                    }
+                    std::string name;
+                    for (auto it : column->GetColumn()) {
+                        if (!name.empty()) name += '.';
+                        name.append(it->GetId().data(), it->GetId().length());
+                    }
+                    Emit(PUSH_VARIABLE, Slot(name));
+                } break;
+                case AstExpr::C_NUMBER: {
+                    Emit(PUSH_CONSTANT, Constant(Number(static_cast<AstConstantValue*>(condition)->GetValue(), false)));
+                } break;
+                case AstExpr::U_NEGATIVE: {
+                    AstExpr *operand = static_cast<AstUnaryOpExpr*>(condition)->GetExpr();
+                    if (operand->GetExprType() != AstExpr::C_NUMBER) {
+                        Fail("unsupported expression");
+                        return;
+                    }
+                    Emit(PUSH_CONSTANT, Constant(Number(static_cast<AstConstantValue*>(operand)->GetValue(), true)));
+                } break;
+                case AstExpr::C_STRING: {
+                    const char *s = static_cast<AstConstantValue*>(condition)->GetValue();
+                    Emit(PUSH_CONSTANT, Constant(PolicyValue::String(_attributes->InternString(s))));
+                } break;
+                case AstExpr::C_TRUE: Emit(PUSH_CONSTANT, Constant(PolicyValue::Bool(true))); break;
+                case AstExpr::C_FALSE: Emit(PUSH_CONSTANT, Constant(PolicyValue::Bool(false))); break;
+                case AstExpr::C_UNKNOWN: Emit(PUSH_CONSTANT, Constant(PolicyValue::Unknown())); break;
+                case AstExpr::C_NULL: Emit(PUSH_CONSTANT, Constant(PolicyValue::Null())); break;
+                default: {
+                    Fail("unsupported expression");
+                } break;
+            }
+        }
+
+        size_t Emit(PolicyOpcode op, uint32_t arg) {
+            _program->_code.push_back({op, arg, 0, 0});
+            /* the depth after op; both ways into a jump target leave one more value than before the jump */
+            if (op == PUSH_CONSTANT || op == PUSH_VARIABLE) {
+                if (++_depth > _program->_max_stack) {
+                    _program->_max_stack = _depth;
+                }
+                if (_depth > PolicyProgram::MAX_STACK) {
+                    Fail("condition needs a deeper stack than MAX_STACK");
+                }
+            } else if (op == OP_AND || op == OP_OR || is_compare(op)) {
+                --_depth;
+            }
+            return _program->_code.size() - 1;
+        }
+
+        void Finish(bool fuse) {
+            Emit(RETURN, 0);
+            _program->_unfused_size = _program->_code.size();
+            if (fuse) {
+                Fuse();
+            }
+            _program->_code.shrink_to_fit();
+            _program->_constants.shrink_to_fit();
+            _program->_slots.shrink_to_fit();
+        }
+
+    private:
+        /*
+         * PUSH_VARIABLE, PUSH_CONSTANT of a number or a string, a compare and a conditional jump go to one
+         * instruction, the first three alone to one without the jump. a sequence is fused only when no
+         * jump lands inside it.
+         */
+        void Fuse() {
+            std::vector<PolicyInstruction> &code = _program->_code;
+            std::vector<bool> landing(code.size() + 1, false);
+            for (auto &it : code) {
+                if (it.op == JUMP_IF_TRUE || it.op == JUMP_IF_FALSE) landing[it.arg] = true;
+            }
+            std::vector<uint32_t> moved(code.size() + 1);      /* old index to new */
+            std::vector<PolicyInstruction> fused;
+            fused.reserve(code.size());
+            for (size_t i = 0; i < code.size();) {
+                moved[i] = fused.size();
+                int first = -1;
+                if (i + 2 < code.size() && code[i].op == PUSH_VARIABLE && code[i + 1].op == PUSH_CONSTANT &&
+                        is_compare(code[i + 2].op) && !landing[i + 1] && !landing[i + 2]) {
+                    PolicyValue::Type type = _program->_constants[code[i + 1].arg].type;
+                    int compare = code[i + 2].op - OP_EQ;
+                    if (type == PolicyValue::T_INT || type == PolicyValue::T_DOUBLE) {
+                        first = CMP_VAR_CONST_EQ + compare * 3;
+                    } else if (type == PolicyValue::T_STRING) {
+                        first = EQ_VAR_STR + compare * 3;   /* = or <>, the compiler allows no other */
+                    }
+                }
+                if (first < 0) {
+                    fused.push_back(code[i]);
+                    ++i;
+                    continue;
+                }
+                PolicyInstruction ins = {(PolicyOpcode)first, code[i].arg, code[i + 1].arg, 0};
+                size_t n = 3;
+                if (i + 3 < code.size() && !landing[i + 3] && (code[i + 3].op == JUMP_IF_TRUE || code[i + 3].op == JUMP_IF_FALSE)) {
+                    ins.op = (PolicyOpcode)(first + (code[i + 3].op == JUMP_IF_TRUE ? 1 : 2));
+                    ins.target = code[i + 3].arg;
+                    n = 4;
+                }
+                for (size_t j = 1; j < n; ++j) {
+                    moved[i + j] = fused.size();
+                }
+                fused.push_back(ins);
+                i += n;
+            }
+            moved[code.size()] = fused.size();
+            for (auto &it : fused) {
+                if (it.op == JUMP_IF_TRUE || it.op == JUMP_IF_FALSE) {
+                    it.arg = moved[it.arg];
+                } else if (is_fused_jump(it.op)) {
+                    it.target = moved[it.target];
+                }
+            }
+            code.swap(fused);
+        }
+
+        uint32_t Slot(const std::string& name) {
+            uint32_t slot = _attributes->GetSlot(name);
+            auto &slots = _program->_slots;
+            if (std::find(slots.begin(), slots.end(), slot) == slots.end()) {
+                slots.push_back(slot);
+            }
+            if (slot >= _program->_slot_limit) {
+                _program->_slot_limit = slot + 1;
+            }
+            return slot;
+        }
+
+        /* an integer unless it has a fraction or an exponent */
+        static PolicyValue Number(const char *text, bool negative) {
+            if (strpbrk(text, ".eE") != nullptr) {
+                double d = strtod(text, nullptr);
+                return PolicyValue::Double(negative ? -d : d);
+            }
+            int64_t i = strtoll(text, nullptr, 10);
+            return PolicyValue::Int(negative ? -i : i);
+        }
+
+        uint32_t Constant(const PolicyValue& value) {
+            auto &constants = _program->_constants;
+            for (size_t i = 0; i < constants.size(); ++i) {
+                if (constants[i].type == value.type && constants[i].i == value.i) return i;
+            }
+            constants.push_back(value);
+            return constants.size() - 1;
+        }
+
+        void Fail(const char *detail) {
+            _e->_code = PolicyException::FAIL;
+            _e->_detail = detail;
+        }
+
+        PolicyProgram       *_program;
+        PolicyAttributes    *_attributes;
+        PolicyException     *_e;
+        unsigned int         _depth = 0;
+    };
+
+    uint32_t PolicyAttributes::GetSlot(const std::string& name) {
+        auto fd = _slots.find(name);
+        if (fd != _slots.end()) {
+            return fd->second;
+        }
+        _names.push_back(name);
+        _slots[name] = _names.size() - 1;
+        return _names.size() - 1;
+    }
+
+    int PolicyAttributes::Find(const std::string& name) const {
+        auto fd = _slots.find(name);
+        return fd == _slots.end() ? -1 : (int)fd->second;
+    }
+
+    int64_t PolicyAttributes::InternString(const std::string& s) {
+        auto fd = _string_ids.find(s);
+        if (fd != _string_ids.end()) {
+            return fd->second;
+        }
+        _strings.push_back(s);
+        _string_ids[s] = _strings.size() - 1;
+        return _strings.size() - 1;
+    }
+
+    int64_t PolicyAttributes::FindString(const std::string& s) const {
+        auto fd = _string_ids.find(s);
+        return fd == _string_ids.end() ? (int64_t)PolicyValue::NO_STRING : fd->second;
+    }
+
+    PolicyRequest::PolicyRequest(const PolicyAttributes& attributes)
+        : _attributes(&attributes), _values(attributes.GetSize(), PolicyValue::Unknown()), _present((attributes.GetSize() + 63) / 64, 0) {}
+
+    void PolicyRequest::Set(uint32_t slot, const PolicyValue& value) {
+        _values[slot] = value;
+        _present[slot / 64] |= (uint64_t)1 << (slot % 64);
+    }
+
+    void PolicyRequest::SetString(uint32_t slot, const std::string& value) {
+        int64_t id = _attributes->FindString(value);
+        if (id == PolicyValue::NO_STRING) {
+            auto fd = _own_strings.find(value);
+            if (fd != _own_strings.end()) {
+                id = fd->second;
+            } else {
+                id = -1 - (int64_t)_own_strings.size();
+                _own_strings[value] = id;
+            }
+        }
+        Set(slot, PolicyValue::String(id));
+    }
+
+    void PolicyRequest::Clear() {
+        for (size_t i = 0; i < _present.size(); ++i) {
+            for (uint64_t bits = _present[i]; bits != 0; bits &= bits - 1) {
+                _values[i * 64 + __builtin_ctzll(bits)] = PolicyValue::Unknown();
+            }
+            _present[i] = 0;
+        }
+        _own_strings.clear();
+    }
+
+    PolicyProgram *compile_policy(AstSearchCondition *condition, PolicyAttributes *attributes, PolicyException *e, bool fuse) {
+        PolicyProgram *program = new PolicyProgram;
+        PolicyCompiler compiler(program, attributes, e);
+        compiler.Compile(condition);
+        if (e->_code != PolicyException::SUCCESS) {
+            delete (program);
+            return nullptr;
+        }
+        compiler.Finish(fuse);
+        return program;
+    }
+
+    static inline bool is_true(const PolicyValue& v) { return v.type == PolicyValue::T_BOOL && v.i == 1; }
+    static inline bool is_false(const PolicyValue& v) { return v.type == PolicyValue::T_BOOL && v.i == 0; }
+
+    template <PolicyOpcode op, typename T>
+    static inline bool holds(T left, T right) {
+        switch (op) {
+            case OP_EQ: return left == right;
+            case OP_NEQ: return left != right;
+            case OP_LT: return left < right;
+            case OP_LE: return left <= right;
+            case OP_GT: return left > right;
+            default: return left >= right;
+        }
+    }
+
+    /* op is one of OP_EQ .. OP_GE, it folds away */
+    template <PolicyOpcode op>
+    static inline PolicyValue compare(const PolicyValue& left, const PolicyValue& right) {
+        if (left.type == PolicyValue::T_INT && right.type == PolicyValue::T_INT) {
+            return PolicyValue::Bool(holds<op>(left.i, right.i));
+        }
+        if ((left.type == PolicyValue::T_INT || left.type == PolicyValue::T_DOUBLE) &&
+                (right.type == PolicyValue::T_INT || right.type == PolicyValue::T_DOUBLE)) {
+            double l = left.type == PolicyValue::T_INT ? (double)left.i : left.d;
+            double r = right.type == PolicyValue::T_INT ? (double)right.i : right.d;
+            return PolicyValue::Bool(holds<op>(l, r));
+        }
+        if ((op == OP_EQ || op == OP_NEQ) && left.type == right.type &&
+                (left.type == PolicyValue::T_BOOL || left.type == PolicyValue::T_STRING)) {
+            return PolicyValue::Bool(holds<op>(left.i, right.i));
+        }
+        return PolicyValue::Unknown();
+    }
+
+    /* a string attribute against the id of a string constant */
+    template <PolicyOpcode op>
+    static inline PolicyValue compare_string(const PolicyValue& value, int64_t id) {
+        if (value.type != PolicyValue::T_STRING) {
+            return PolicyValue::Unknown();
+        }
+        return PolicyValue::Bool(holds<op>(value.i, id));
+    }
+
+#if defined(__GNUC__)
+#define POLICY_THREADED 1
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"     /* labels as values */
+#define HANDLER(op)     case op: op##_HANDLER:
+#define NEXT()          if (threaded) goto *handlers[pc->op]; else continue
+#else
+#define POLICY_THREADED 0
+#define HANDLER(op)     case op:
+#define NEXT()          continue
+#endif
+
+    /* a compare on the stack, then its superinstructions; COMPARE pushes the result of the fused compare */
+#define FUSED_HANDLERS(name, COMPARE) \
+                HANDLER(name) { \
+                    *++top = COMPARE; \
+                    ++pc; \
+                } NEXT(); \
+                HANDLER(name##_JTRUE) { \
+                    *++top = COMPARE; \
+                    pc = is_true(*top) ? code + pc->target : pc + 1; \
+                } NEXT(); \
+                HANDLER(name##_JFALSE) { \
+                    *++top = COMPARE; \
+                    pc = is_false(*top) ? code + pc->target : pc + 1; \
+                } NEXT();
+#define COMPARE_HANDLERS(name) \
+                HANDLER(OP_##name) { \
+                    PolicyValue right = *top--; \
+                    *top = compare<OP_##name>(*top, right); \
+                    ++pc; \
+                } NEXT(); \
+                FUSED_HANDLERS(CMP_VAR_CONST_##name, compare<OP_##name>(values[pc->arg], constants[pc->k]))
+
+    /*
+     * the interpreter, written once for both dispatches. a handler is a case of the switch and, threaded,
+     * also a label: it ends by jumping through the table straight to the next handler, each handler with
+     * its own indirect branch, instead of going back to the one of the switch.
+     */
+    template <bool threaded>
+    static PolicyBool run(const PolicyInstruction *code, const PolicyValue *constants, const PolicyValue *values) {
+        PolicyValue stack[PolicyProgram::MAX_STACK];
+        PolicyValue *top = stack - 1;
+        const PolicyInstruction *pc = code;
+#if POLICY_THREADED
+        static const void *const handlers[] = {
+#define GSP_POLICY_OPCODE(op) &&op##_HANDLER,
+            GSP_POLICY_OPCODES(GSP_POLICY_OPCODE)
+#undef GSP_POLICY_OPCODE
+        };
+        if (threaded) goto *handlers[pc->op];
+#endif
+        for (;;) {
+            switch (pc->op) {
+                HANDLER(PUSH_CONSTANT) {
+                    *++top = constants[pc->arg];
+                    ++pc;
+                } NEXT();
+                HANDLER(PUSH_VARIABLE) {
+                    *++top = values[pc->arg];
+                    ++pc;
+                } NEXT();
+                HANDLER(OP_AND) {
+                    PolicyValue right = *top--;
+                    if (is_false(*top) || is_false(right)) *top = PolicyValue::Bool(false);
+                    else if (is_true(*top) && is_true(right)) *top = PolicyValue::Bool(true);
+                    else *top = PolicyValue::Unknown();
+                    ++pc;
+                } NEXT();
+                HANDLER(OP_OR) {
+                    PolicyValue right = *top--;
+                    if (is_true(*top) || is_true(right)) *top = PolicyValue::Bool(true);
+                    else if (is_false(*top) && is_false(right)) *top = PolicyValue::Bool(false);
+                    else *top = PolicyValue::Unknown();
+                    ++pc;
+                } NEXT();
+                COMPARE_HANDLERS(EQ)
+                COMPARE_HANDLERS(NEQ)
+                COMPARE_HANDLERS(LT)
+                COMPARE_HANDLERS(LE)
+                COMPARE_HANDLERS(GT)
+                COMPARE_HANDLERS(GE)
+                FUSED_HANDLERS(EQ_VAR_STR, compare_string<OP_EQ>(values[pc->arg], constants[pc->k].i))
+                FUSED_HANDLERS(NEQ_VAR_STR, compare_string<OP_NEQ>(values[pc->arg], constants[pc->k].i))
+                HANDLER(JUMP_IF_TRUE) {
+                    pc = is_true(*top) ? code + pc->arg : pc + 1;
+                } NEXT();
+                HANDLER(JUMP_IF_FALSE) {
+                    pc = is_false(*top) ? code + pc->arg : pc + 1;
+                } NEXT();
+                HANDLER(RETURN) {
+                    assert(top == stack);
+                    return is_true(*top) ? B_TRUE : is_false(*top) ? B_FALSE : B_UNKNOWN;
+                }
+            }
+        }
+    }
+
+#undef COMPARE_HANDLERS
+#undef FUSED_HANDLERS
+#undef HANDLER
+#undef NEXT
+#if POLICY_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+    PolicyBool PolicyProgram::Evaluate(const PolicyRequest& request, PolicyDispatch dispatch) const {
+        assert(request.GetSize() >= _slot_limit);
+        assert(_max_stack <= MAX_STACK);
+        if (dispatch == DISPATCH_THREADED) {
+            return run<true>(_code.data(), _constants.data(), request.GetValues());
+        }
+        return run<false>(_code.data(), _constants.data(), request.GetValues());
+    }
+
+    static std::string value_text(const PolicyValue& v, const PolicyAttributes *attributes) {
+        char buf[32];
+        switch (v.type) {
+            case PolicyValue::T_UNKNOWN: return "UNKNOWN";
+            case PolicyValue::T_NULL: return "NULL";
+            case PolicyValue::T_BOOL: return v.i ? "TRUE" : "FALSE";
+            case PolicyValue::T_INT: snprintf(buf, sizeof(buf), "%lld", (long long)v.i); return buf;
+            case PolicyValue::T_DOUBLE: snprintf(buf, sizeof(buf), "%g", v.d); return buf;
+            case PolicyValue::T_STRING: return "'" + attributes->GetString(v.i) + "'";
+        }
+        return std::string();
+    }
+
+    size_t PolicyProgram::GetRetainedSize() const {
+        return sizeof(*this) + _code.capacity() * sizeof(PolicyInstruction) +
+               _constants.capacity() * sizeof(PolicyValue) + _slots.capacity() * sizeof(uint32_t);
+    }
+
+    std::string PolicyProgram::ToString() const {
+        static const char *names[] = {
+#define GSP_POLICY_OPCODE(op) #op,
+            GSP_POLICY_OPCODES(GSP_POLICY_OPCODE)
+#undef GSP_POLICY_OPCODE
+        };
+        std::string s;
+        char buf[32];
+        for (size_t i = 0; i < _code.size(); ++i) {
+            const PolicyInstruction &ins = _code[i];
+            snprintf(buf, sizeof(buf), "%4zu  ", i);
+            s += buf;
+            s += names[ins.op];
+            if (ins.op == PUSH_CONSTANT) {
+                s += ' ' + value_text(_constants[ins.arg], _attributes);
+            } else if (ins.op == PUSH_VARIABLE) {
+                s += ' ' + _attributes->GetName(ins.arg);
+            } else if (ins.op == JUMP_IF_TRUE || ins.op == JUMP_IF_FALSE) {
+                snprintf(buf, sizeof(buf), " %u", ins.arg);
+                s += buf;
+            } else if (ins.op >= CMP_VAR_CONST_EQ) {
+                s += ' ' + _attributes->GetName(ins.arg) + ' ' + value_text(_constants[ins.k], _attributes);
+                if (is_fused_jump(ins.op)) {
+                    snprintf(buf, sizeof(buf), " %u", ins.target);
+                    s += buf;
+                }
+            }
+            s += '\n';
+        }
+        return s;
+    }
+}
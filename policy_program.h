@@ -0,0 +1,172 @@
+#ifndef GSP_POLICY_PROGRAM_H
+#define GSP_POLICY_PROGRAM_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+namespace GSP {
+    class AstExpr;
+    typedef AstExpr AstSearchCondition;
+
+    /* the truth values of design.txt, the result of a policy */
+    enum PolicyBool { B_FALSE = 0, B_TRUE = 1, B_UNKNOWN = -1 };
+
+    /*
+     * a value of a request, a constant of a policy or an entry of the stack. a truth value is a T_BOOL,
+     * B_UNKNOWN is T_UNKNOWN, which is also what an attribute the request does not have reads as. a string
+     * is the id PolicyAttributes interned it to, or a negative id the request gave it when no policy
+     * mentions it.
+     */
+    struct PolicyValue {
+        enum Type : uint8_t { T_UNKNOWN, T_NULL, T_BOOL, T_INT, T_DOUBLE, T_STRING };
+        enum { NO_STRING = -1 };    /* what FindString() returns for a string no policy mentions */
+        Type        type;
+        union {
+            int64_t i;      /* T_INT, T_STRING, T_BOOL as 0 or 1 */
+            double  d;
+        };
+
+        static PolicyValue Unknown()            { PolicyValue v; v.type = T_UNKNOWN; v.i = 0; return v; }
+        static PolicyValue Null()               { PolicyValue v; v.type = T_NULL; v.i = 0; return v; }
+        static PolicyValue Bool(bool b)         { PolicyValue v; v.type = T_BOOL; v.i = b; return v; }
+        static PolicyValue Int(int64_t i)       { PolicyValue v; v.type = T_INT; v.i = i; return v; }
+        static PolicyValue Double(double d)     { PolicyValue v; v.type = T_DOUBLE; v.d = d; return v; }
+        static PolicyValue String(int64_t id)   { PolicyValue v; v.type = T_STRING; v.i = id; return v; }
+    };
+
+    /*
+     * the instructions, arg is the constant pool index of PUSH_CONSTANT, the slot of PUSH_VARIABLE and the
+     * target of a jump. OP_AND and OP_OR pop two truth values and push the three valued result. a compare
+     * pops two values and pushes B_UNKNOWN when either is unknown or null or their types do not compare:
+     * numbers compare with numbers, strings and truth values only with = and <>. a jump leaves the top, it
+     * is the value of the OR or AND cut short. the superinstructions are PUSH_VARIABLE arg, PUSH_CONSTANT k,
+     * a compare and, with _J*, a jump to target; _CONST for a number, _STR for a string, whose ids are
+     * compared. the fused forms come in threes per compare in this order, the compiler counts on it.
+     */
+#define GSP_POLICY_OPCODES(X) \
+        X(PUSH_CONSTANT) X(PUSH_VARIABLE) X(OP_AND) X(OP_OR) \
+        X(OP_EQ) X(OP_NEQ) X(OP_LT) X(OP_LE) X(OP_GT) X(OP_GE) \
+        X(JUMP_IF_TRUE) X(JUMP_IF_FALSE) X(RETURN) \
+        X(CMP_VAR_CONST_EQ) X(CMP_VAR_CONST_EQ_JTRUE) X(CMP_VAR_CONST_EQ_JFALSE) \
+        X(CMP_VAR_CONST_NEQ) X(CMP_VAR_CONST_NEQ_JTRUE) X(CMP_VAR_CONST_NEQ_JFALSE) \
+        X(CMP_VAR_CONST_LT) X(CMP_VAR_CONST_LT_JTRUE) X(CMP_VAR_CONST_LT_JFALSE) \
+        X(CMP_VAR_CONST_LE) X(CMP_VAR_CONST_LE_JTRUE) X(CMP_VAR_CONST_LE_JFALSE) \
+        X(CMP_VAR_CONST_GT) X(CMP_VAR_CONST_GT_JTRUE) X(CMP_VAR_CONST_GT_JFALSE) \
+        X(CMP_VAR_CONST_GE) X(CMP_VAR_CONST_GE_JTRUE) X(CMP_VAR_CONST_GE_JFALSE) \
+        X(EQ_VAR_STR) X(EQ_VAR_STR_JTRUE) X(EQ_VAR_STR_JFALSE) \
+        X(NEQ_VAR_STR) X(NEQ_VAR_STR_JTRUE) X(NEQ_VAR_STR_JFALSE)
+
+    enum PolicyOpcode : uint8_t {
+#define GSP_POLICY_OPCODE(op) op,
+        GSP_POLICY_OPCODES(GSP_POLICY_OPCODE)
+#undef GSP_POLICY_OPCODE
+    };
+
+    /* how Evaluate() gets from one instruction to the next */
+    enum PolicyDispatch {
+        DISPATCH_SWITCH,        /* a switch in a loop */
+        DISPATCH_THREADED       /* computed goto from each handler to the next; the switch where gcc's labels as values are missing */
+    };
+
+    struct PolicyInstruction {
+        PolicyOpcode    op;
+        uint32_t        arg;
+        uint32_t        k;          /* of a superinstruction */
+        uint32_t        target;
+    };
+
+    struct PolicyException {
+        enum { SUCCESS, FAIL } _code = SUCCESS;
+        std::string     _detail;
+    };
+
+    /*
+     * the attribute names and the string constants of a policy set. a name gets the next dense slot when
+     * the first policy compiled against the dictionary reads it, a string its id when the first policy
+     * mentions it; policies evaluated against the same requests share one dictionary.
+     */
+    class PolicyAttributes {
+    public:
+        uint32_t            GetSlot(const std::string& name);           /* adds name when new */
+        int                 Find(const std::string& name) const;        /* -1 when no policy reads name */
+        size_t              GetSize() const { return _names.size(); }
+        const std::string&  GetName(uint32_t slot) const { return _names[slot]; }
+        int64_t             InternString(const std::string& s);
+        int64_t             FindString(const std::string& s) const;     /* NO_STRING when no policy mentions s */
+        const std::string&  GetString(int64_t id) const { return _strings[id]; }
+    private:
+        std::vector<std::string>                    _names;
+        std::unordered_map<std::string, uint32_t>   _slots;
+        std::vector<std::string>                    _strings;
+        std::unordered_map<std::string, int64_t>    _string_ids;
+    };
+
+    /* the attribute values of one request by slot, an attribute not set reads as B_UNKNOWN */
+    class PolicyRequest {
+    public:
+        /* sized to the dictionary as it is now, compile the policy set first */
+        explicit PolicyRequest(const PolicyAttributes& attributes);
+        void                SetInt(uint32_t slot, int64_t value) { Set(slot, PolicyValue::Int(value)); }
+        void                SetDouble(uint32_t slot, double value) { Set(slot, PolicyValue::Double(value)); }
+        void                SetBool(uint32_t slot, bool value) { Set(slot, PolicyValue::Bool(value)); }
+        void                SetNull(uint32_t slot) { Set(slot, PolicyValue::Null()); }
+        /* a string no policy mentions is equal to none of their constants, only to the same string of this request */
+        void                SetString(uint32_t slot, const std::string& value);
+        bool                IsSet(uint32_t slot) const { return (_present[slot / 64] >> (slot % 64)) & 1; }
+        const PolicyValue&  Get(uint32_t slot) const { return _values[slot]; }
+        const PolicyValue  *GetValues() const { return _values.data(); }
+        size_t              GetSize() const { return _values.size(); }
+        void                Clear();        /* unset all, for reuse by the next request */
+    private:
+        void                Set(uint32_t slot, const PolicyValue& value);
+        const PolicyAttributes     *_attributes;
+        std::vector<PolicyValue>    _values;    /* unknown where not set, so a lookup is one load */
+        std::vector<uint64_t>       _present;
+        std::unordered_map<std::string, int64_t>    _own_strings;   /* no policy mentions them, ids -1, -2, .. */
+    };
+
+    /*
+     * a search condition compiled for the stack machine of design.txt. the code is one array ending in
+     * RETURN, jumps hold the index of their target, columns are read by slot. the compiler works out
+     * the deepest the stack gets, Evaluate() runs on a local array of MAX_STACK values without checking
+     * it. Evaluate() only reads the program: any number of threads may run one at once and an evaluation
+     * does not allocate. the dictionary the program was compiled against must outlive it.
+     */
+    class PolicyProgram {
+    public:
+        enum { MAX_STACK = 64 };    /* a program may need no more, a left deep chain of n ORs of comparisons needs 3 */
+
+        PolicyBool                              Evaluate(const PolicyRequest& request, PolicyDispatch dispatch = DISPATCH_THREADED) const;
+        const std::vector<uint32_t>&            GetSlots() const { return _slots; }     /* the attributes read */
+        const std::vector<PolicyInstruction>&   GetCode() const { return _code; }
+        const std::vector<PolicyValue>&         GetConstants() const { return _constants; }
+        unsigned int                            GetMaxStack() const { return _max_stack; }
+        size_t                                  GetUnfusedSize() const { return _unfused_size; }   /* instructions before fusing */
+        std::string                             ToString() const;   /* one instruction per line */
+        /* bytes the program holds, the shared dictionary is not counted */
+        size_t                                  GetRetainedSize() const;
+    private:
+        friend class PolicyCompiler;
+        std::vector<PolicyInstruction>  _code;
+        std::vector<PolicyValue>        _constants;
+        std::vector<uint32_t>           _slots;
+        uint32_t                        _slot_limit = 0;    /* a request needs more slots than this */
+        unsigned int                    _max_stack = 0;
+        size_t                          _unfused_size = 0;
+        const PolicyAttributes         *_attributes = nullptr;
+    };
+
+    /*
+     * OR, AND and the six compares over columns and constants: numbers, strings, TRUE, FALSE, UNKNOWN and
+     * NULL. null with e failed on anything else, on a string ordered with < or >, or when the stack would
+     * grow past MAX_STACK. the dotted column names get their slots and the strings their ids from
+     * attributes. with fuse, a column compared to a number or a string, and the jump after it, become one
+     * superinstruction.
+     */
+    PolicyProgram  *compile_policy  (AstSearchCondition *condition, PolicyAttributes *attributes, PolicyException *e,
+                                     bool fuse = true);
+}
+
+#endif
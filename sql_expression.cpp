@@ -115,14 +115,17 @@ namespace GSP {
 
     AstConstantValue::~AstConstantValue() {
         if (GetExprType() == C_STRING || GetExprType() == C_NUMBER) {
-            free (u._other_data);
+            Arena::Free(u._other_data);
             u._other_data = nullptr;
         }
     }
 
     void AstConstantValue::SetValue(int data) { u._int_data = data; }
 
-    void AstConstantValue::SetValue(const std::string& value) { u._other_data = strdup(value.c_str()); }
+    void AstConstantValue::SetValue(const std::string& value) {
+        u._other_data = static_cast<char*>(Arena::Malloc(value.length() + 1));
+        memcpy(u._other_data, value.c_str(), value.length() + 1);
+    }
 
     int  AstConstantValue::GetValueAsInt() {
         return atoi(u._other_data);
@@ -159,8 +162,12 @@ namespace GSP {
 
     void AstFuncCall::SetFuncName(const AstIds& name) { _func_name = name; }
 
+    const AstIds& AstFuncCall::GetFuncName() { return _func_name; }
+
     void AstFuncCall::SetParams(AstExprList *params) { _params = params; }
 
+    AstExprList *AstFuncCall::GetParams() { return _params; }
+
     /* AstCaseExpr */
     AstCaseExpr::AstCaseExpr() : AstExpr(EXPR_CASE), _arg(nullptr), _else(nullptr) {}
 
@@ -14,7 +14,7 @@ namespace GSP {
     class AstCaseExpr;
     class AstExprList;
     class AstSelectStmt;
-    typedef std::vector<AstExpr*> AstExprs;
+    typedef AstVector<AstExpr*> AstExprs;
 
     class AstExpr : public IObject {
     public:
@@ -184,8 +184,10 @@ namespace GSP {
     public:
         AstFuncCall(const AstIds& func_name, AstExprList *params);
         ~AstFuncCall();
-        void SetFuncName(const AstIds& name);
-        void SetParams(AstExprList *params);
+        void            SetFuncName(const AstIds& name);
+        const AstIds&   GetFuncName();
+        void            SetParams(AstExprList *params);
+        AstExprList    *GetParams();
     private:
         AstIds           _func_name;
         AstExprList     *_params;       /* null means no param */
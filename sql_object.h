@@ -3,6 +3,7 @@
 
 #include <string>
 #include <assert.h>
+#include "arena.h"
 
 namespace GSP {
     enum SQLObjectType {
@@ -15,7 +16,7 @@ namespace GSP {
         AST_SUBQUERY_TABLE_REF,
         AST_EXPR,
     };
-    class IObject {
+    class IObject : public ArenaObject {
     public:
         IObject () : _parent(nullptr), _obj_type(AST_ANY) {}
         IObject (SQLObjectType obj_type) : _parent(nullptr), _obj_type(obj_type) {}
@@ -28,16 +29,16 @@ namespace GSP {
         SQLObjectType        _obj_type;
     };
 
-    class AstId {
+    class AstId : public ArenaObject {
     public:
-        AstId(const std::string& id) : _id(id) {}
-        void SetId(const std::string& id) { _id = id; }
-        const std::string& GetId() { return _id; }
+        AstId(const std::string& id) : _id(id.data(), id.length()) {}
+        void SetId(const std::string& id) { _id.assign(id.data(), id.length()); }
+        const AstString& GetId() { return _id; }
     private:
-        std::string     _id;
+        AstString       _id;
     };
 
-    typedef std::vector<AstId*>                 AstIds;
+    typedef AstVector<AstId*>                   AstIds;
 }
 
 #endif
\ No newline at end of file
@@ -1,11 +1,46 @@
 #include "sql_select_stmt.h"
 #include "sql_expression.h"
 #include "sql_table_ref.h"
+#include "parse_select_stmt.h"
+#include "parse_exception.h"
+#include "lex.h"
 
 namespace GSP {
     /* AstSelectStmt */
     AstSelectStmt::AstSelectStmt(AstWithClause *with_clause, AstQueryExpressionBody *query_expression_body, const AstOrderByItems& order_by_items) : IObject(AST_SELECT_STMT),
-    _with_clasue(with_clause), _query_expression_body(query_expression_body), _order_by_items(order_by_items) {}
+    _with_clasue(with_clause), _query_expression_body(query_expression_body), _order_by_items(order_by_items), _lazy(false) {}
+
+    AstSelectStmt::AstSelectStmt(const char *sql, unsigned int length) : IObject(AST_SELECT_STMT),
+    _with_clasue(nullptr), _query_expression_body(nullptr), _lazy(true), _sql(sql, length) {}
+
+    bool AstSelectStmt::Parse(ParseException *e, bool subqueries) {
+        if (!_lazy) {
+            return _query_expression_body != nullptr;
+        }
+        /* the parts go where the statement lives */
+        ArenaScope scope(_order_by_items.get_allocator().GetArena());
+        std::string sql(_sql.data(), _sql.length());
+        ILex *lex = make_lex(sql.c_str());
+        lex->next();
+        AstSelectStmt *stmt = parse_select_stmt_lazy(lex, e, !subqueries);
+        if (e->_code == ParseException::SUCCESS && lex->token()->type() != END_P) {
+            delete (stmt);
+            e->SetFail(END_P, lex);
+        }
+        free_lex(lex);
+        if (e->_code != ParseException::SUCCESS) {
+            return false;
+        }
+        _with_clasue = stmt->_with_clasue;
+        _query_expression_body = stmt->_query_expression_body;
+        _order_by_items.swap(stmt->_order_by_items);
+        stmt->_with_clasue = nullptr;
+        stmt->_query_expression_body = nullptr;
+        delete (stmt);
+        _sql.clear();
+        _lazy = false;
+        return true;
+    }
 
     AstSelectStmt::~AstSelectStmt() {
         delete (_with_clasue); _with_clasue = nullptr;
@@ -131,7 +166,7 @@ namespace GSP {
 
     /* AstQueryPrimary */
     AstQueryPrimary::AstQueryPrimary(SELECT_TYPE select_type) : AstQueryExpressionBody(AST_QUERY_PRIMARY),
-        _select_type(select_type), _where_search_condition(nullptr), _having_search_condition(nullptr) {}
+        _select_type(select_type), _where_search_condition(nullptr), _group_type(GROUP_BY), _having_search_condition(nullptr) {}
 
     AstQueryPrimary::~AstQueryPrimary() {
         for (auto it : _projection_list) delete (it);
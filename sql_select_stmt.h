@@ -18,16 +18,31 @@ namespace GSP {
     typedef AstExpr                             AstSearchCondition;
     typedef AstExpr                             AstRowExpr;
     typedef AstRowExpr                          AstGroupingElem;
-    typedef std::vector<AstGroupingElem*>       AstGroupingElems;
-    typedef std::vector<AstCommonTableExpr*>    AstCommonTableExprs;
-    typedef std::vector<AstOrderByItem*>        AstOrderByItems;
-    typedef std::vector<AstProjection*>         AstProjections;
-    typedef std::vector<AstTableRef*>           AstTableRefs;
+    typedef AstVector<AstGroupingElem*>         AstGroupingElems;
+    typedef AstVector<AstCommonTableExpr*>      AstCommonTableExprs;
+    typedef AstVector<AstOrderByItem*>          AstOrderByItems;
+    typedef AstVector<AstProjection*>           AstProjections;
+    typedef AstVector<AstTableRef*>             AstTableRefs;
+
+    class ParseException;
 
     class AstSelectStmt : public IObject {
     public:
         AstSelectStmt(AstWithClause *with_clause, AstQueryExpressionBody *query_expression_body, const AstOrderByItems& order_by_items);
+        /*
+         * a lazy statement, only the text of the query. it reads as empty, no body, until Parse()
+         * succeeds; the getters never parse, so readers of a shared tree do not race.
+         */
+        AstSelectStmt(const char *sql, unsigned int length);
         ~AstSelectStmt() ;
+        bool                    IsParsed() const { return !_lazy; }
+        /* the text of a lazy statement, what a failed Parse() gives positions in */
+        const char             *GetSql() const { return _sql.c_str(); }
+        /*
+         * parse a lazy statement, with subqueries nothing in it stays lazy. false with e set when the
+         * text is no query, positions are relative to it. a parsed statement is left as it is.
+         */
+        bool                    Parse(ParseException *e, bool subqueries = false);
         void                    SetWithClause(AstWithClause *with_clasue);
         AstWithClause          *GetWithClause();
         void                    SetOrderByItems(const AstOrderByItems& order_by_items);
@@ -38,9 +53,11 @@ namespace GSP {
         AstWithClause                   *_with_clasue;      /* null means no with clause */
         AstQueryExpressionBody          *_query_expression_body;
         AstOrderByItems                  _order_by_items;  /* size 0 means no order by */
+        bool                             _lazy;
+        AstString                        _sql;              /* of a lazy statement */
     };
 
-    class AstWithClause {
+    class AstWithClause : public ArenaObject {
     public:
         enum REC_TYPE { NIL_RECURSIVE, RECURSIVE };
         AstWithClause(REC_TYPE rec_type, const AstCommonTableExprs& ctes);
@@ -54,7 +71,7 @@ namespace GSP {
         AstCommonTableExprs                 _ctes;
     };
 
-    class AstCommonTableExpr {
+    class AstCommonTableExpr : public ArenaObject {
     public:
         AstCommonTableExpr(AstId *cte_name);
         ~AstCommonTableExpr();
@@ -128,7 +145,7 @@ namespace GSP {
         AstSearchCondition             *_having_search_condition;   /* null means NO HAVING */
     };
 
-    class AstProjection {
+    class AstProjection : public ArenaObject {
     public:
         AstProjection(AstRowExpr *expr, AstId *alias);
         ~AstProjection();
@@ -141,7 +158,7 @@ namespace GSP {
         AstId           *_alias;    /* null means no alias */
     };
 
-    class AstOrderByItem {
+    class AstOrderByItem : public ArenaObject {
     public:
         enum ORDER_TYPE { NIL, ASC, DESC };
         AstOrderByItem(ORDER_TYPE order_type, AstRowExpr *expr);
@@ -73,6 +73,10 @@ namespace GSP {
         return _ids;
     }
 
+    AstId *AstRelation::GetAlias() {
+        return _alias;
+    }
+
     /* AstSubQueryTableRef */
     AstSubQueryTableRef::AstSubQueryTableRef(AstSelectStmt *subquery, AstId *alias, const AstIds& col_alias) : AstTableRef(AST_SUBQUERY_TABLE_REF),
     _subquery(subquery), _alias(alias), _col_alias(col_alias) {}
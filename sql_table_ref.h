@@ -56,6 +56,7 @@ namespace GSP {
         TABLE_REF_TYPE  GetTableRefType() override;
         void            SetRelationAndAlias(const AstIds& ids, AstId *alias);
         const AstIds&   GetIds();
+        AstId          *GetAlias();
     private:
         AstIds              _ids;
         AstId              *_alias;
@@ -0,0 +1,376 @@
+#include "stmt_cache.h"
+#include "fingerprint.h"
+#include "parse_exception.h"
+#include "parse_select_stmt.h"
+#include "sql_select_stmt.h"
+#include "sql_table_ref.h"
+#include "sql_expression.h"
+#include "arena.h"
+#include "visitor.h"
+#include "lex.h"
+
+namespace GSP {
+
+    struct StmtTemplate {
+        Arena                                               arena;
+        AstSelectStmt                                      *stmt;       /* in arena, never changed once cached */
+        std::unordered_map<const AstConstantValue*, size_t> slots;      /* the constants of stmt, to their literal */
+    };
+
+    /*
+     * copies a tree into the current arena, visiting it in source order. the constants of the copy are
+     * collected in slots, when literals is given the i-th NUMBER/STRING constant takes literals[i] of sql as value
+     */
+    struct AstCopier : public AstVisitor<AstCopier, AstExpr*> {
+        const char                             *sql;
+        const std::vector<FingerprintLiteral>  *literals;
+        std::vector<AstConstantValue*>          slots;
+
+        AstSelectStmt          *Copy(AstSelectStmt *stmt);
+        AstQueryExpressionBody *Copy(AstQueryExpressionBody *body);
+        AstTableRef            *Copy(AstTableRef *table_ref);
+        AstExpr                *Copy(AstExpr *expr);
+        AstId                  *Copy(AstId *id) { return id == nullptr ? nullptr : new AstId(id->GetId().c_str()); }
+        AstIds                  Copy(const AstIds& ids);
+        AstExprs                Copy(const AstExprs& exprs);
+        AstExprList            *Copy(AstExprList *list) { return list == nullptr ? nullptr : new AstExprList(Copy(list->GetExprs())); }
+
+        AstExpr    *VisitBinaryOp(AstBinaryOpExpr *expr);
+        AstExpr    *VisitUnaryOp(AstUnaryOpExpr *expr);
+        AstExpr    *VisitQuantifiedCompare(AstQuantifiedCompareExpr *expr);
+        AstExpr    *VisitExists(AstExistsExpr *expr);
+        AstExpr    *VisitIn(AstInExpr *expr);
+        AstExpr    *VisitBetween(AstBetweenExpr *expr);
+        AstExpr    *VisitLike(AstLikeExpr *expr);
+        AstExpr    *VisitConstant(AstConstantValue *expr);
+        AstExpr    *VisitSubquery(AstSubqueryExpr *expr);
+        AstExpr    *VisitExprList(AstExprList *expr) { return Copy(expr); }
+        AstExpr    *VisitCase(AstCaseExpr *expr);
+        AstExpr    *VisitFuncCall(AstFuncCall *expr);
+        AstExpr    *VisitColumnRef(AstColumnRef *expr);
+    };
+
+    AstSelectStmt *AstCopier::Copy(AstSelectStmt *stmt) {
+        if (stmt == nullptr) {
+            return nullptr;
+        }
+        AstWithClause *with = nullptr;
+        if (stmt->GetWithClause() != nullptr) {
+            AstCommonTableExprs ctes;
+            for (auto it : stmt->GetWithClause()->GetCtes()) {
+                AstCommonTableExpr *cte = new AstCommonTableExpr(Copy(it->GetCteName()));
+                cte->SetCteColumns(Copy(it->GetCteColumns()));
+                cte->SetQuery(Copy(it->GetQuery()));
+                ctes.push_back(cte);
+            }
+            with = new AstWithClause(stmt->GetWithClause()->GetRecType(), ctes);
+        }
+        AstQueryExpressionBody *body = Copy(stmt->GetBody());
+        AstOrderByItems items;
+        for (auto it : stmt->GetOrderByItems()) {
+            items.push_back(new AstOrderByItem(it->GetOrderType(), Copy(it->GetExpr())));
+        }
+        return new AstSelectStmt(with, body, items);
+    }
+
+    AstQueryExpressionBody *AstCopier::Copy(AstQueryExpressionBody *body) {
+        if (body == nullptr) {
+            return nullptr;
+        }
+        if (body->GetSetType() != AstQueryExpressionBody::SIMPLE) {
+            AstQuerySet *set = static_cast<AstQuerySet*>(body);
+            AstQueryExpressionBody *left = Copy(set->GetLeft());
+            AstQueryExpressionBody *right = Copy(set->GetRight());
+            return new AstQuerySet(set->GetSetType(), left, right);
+        }
+        AstQueryPrimary *primary = static_cast<AstQueryPrimary*>(body);
+        AstQueryPrimary *r = new AstQueryPrimary(primary->GetSelectType());
+        AstProjections projections;
+        for (auto it : primary->GetProjectionList()) {
+            AstRowExpr *expr = Copy(it->GetExpr());
+            projections.push_back(new AstProjection(expr, Copy(it->GetAlias())));
+        }
+        r->SetProjectionList(projections);
+        AstTableRefs from;
+        for (auto it : primary->GetFrom()) {
+            from.push_back(Copy(it));
+        }
+        r->SetFrom(from);
+        r->SetWhere(Copy(primary->GetWhere()));
+        r->SetGroupList(Copy(primary->GetGroupList()));
+        r->SetGroupType(primary->GetGroupType());
+        r->SetHaving(Copy(primary->GetHaving()));
+        return r;
+    }
+
+    AstTableRef *AstCopier::Copy(AstTableRef *table_ref) {
+        switch (table_ref->GetTableRefType()) {
+            case AstTableRef::RELATION: {
+                AstRelation *relation = static_cast<AstRelation*>(table_ref);
+                return new AstRelation(Copy(relation->GetIds()), Copy(relation->GetAlias()));
+            }
+            case AstTableRef::SUBQUERY: {
+                AstSubQueryTableRef *subquery = static_cast<AstSubQueryTableRef*>(table_ref);
+                AstSelectStmt *query = Copy(subquery->GetQuery());
+                return new AstSubQueryTableRef(query, Copy(subquery->GetAlias()), Copy(subquery->GetColAlias()));
+            }
+            default: {
+                AstTableJoin *join = static_cast<AstTableJoin*>(table_ref);
+                AstTableRef *left = Copy(join->GetLeft());
+                AstTableRef *right = Copy(join->GetRight());
+                return new AstTableJoin(join->GetJoinType(), left, right, Copy(join->GetOn()));
+            }
+        }
+    }
+
+    AstExpr *AstCopier::Copy(AstExpr *expr) {
+        return expr == nullptr ? nullptr : Visit(expr);
+    }
+
+    AstExpr *AstCopier::VisitBinaryOp(AstBinaryOpExpr *expr) {
+        AstExpr *left = Copy(expr->GetLeft());
+        return new AstBinaryOpExpr(expr->GetExprType(), left, Copy(expr->GetRight()));
+    }
+
+    AstExpr *AstCopier::VisitUnaryOp(AstUnaryOpExpr *expr) {
+        return new AstUnaryOpExpr(expr->GetExprType(), Copy(expr->GetExpr()));
+    }
+
+    AstExpr *AstCopier::VisitQuantifiedCompare(AstQuantifiedCompareExpr *expr) {
+        AstExpr *left = Copy(expr->GetLeft());
+        return new AstQuantifiedCompareExpr(expr->GetExprType(), left, Copy(expr->GetQuery()));
+    }
+
+    AstExpr *AstCopier::VisitExists(AstExistsExpr *expr) {
+        return new AstExistsExpr(Copy(expr->GetQuery()));
+    }
+
+    AstExpr *AstCopier::VisitIn(AstInExpr *expr) {
+        AstExpr *left = Copy(expr->GetLeft());
+        return new AstInExpr(expr->GetExprType(), left, Copy(expr->GetIn()));
+    }
+
+    AstExpr *AstCopier::VisitBetween(AstBetweenExpr *expr) {
+        AstExpr *left = Copy(expr->GetLeft());
+        AstExpr *from = Copy(expr->GetFrom());
+        return new AstBetweenExpr(expr->GetExprType(), left, from, Copy(expr->GetTo()));
+    }
+
+    AstExpr *AstCopier::VisitLike(AstLikeExpr *expr) {
+        AstExpr *left = Copy(expr->GetLeft());
+        AstExpr *right = Copy(expr->GetRight());
+        return new AstLikeExpr(expr->GetExprType(), left, right, Copy(expr->GetEscape()));
+    }
+
+    AstExpr *AstCopier::VisitConstant(AstConstantValue *expr) {
+        AstExpr::EXPR_TYPE tp = expr->GetExprType();
+        AstConstantValue *r = new AstConstantValue(tp);
+        if (tp != AstExpr::C_NUMBER && tp != AstExpr::C_STRING) {
+            return r;
+        }
+        if (literals != nullptr && slots.size() < literals->size()) {
+            r->SetValue(fingerprint_literal(sql, (*literals)[slots.size()]));
+        } else {
+            r->SetValue(expr->GetValue());
+        }
+        slots.push_back(r);
+        return r;
+    }
+
+    AstExpr *AstCopier::VisitSubquery(AstSubqueryExpr *expr) {
+        return new AstSubqueryExpr(Copy(expr->GetQuery()));
+    }
+
+    AstExpr *AstCopier::VisitCase(AstCaseExpr *expr) {
+        AstCaseExpr *r = new AstCaseExpr();
+        r->SetArg(Copy(expr->GetArg()));
+        AstExprs when_list, then_list;
+        for (size_t i = 0; i < expr->GetWhenList().size(); ++i) {
+            when_list.push_back(Copy(expr->GetWhenList()[i]));
+            then_list.push_back(Copy(expr->GetThenList()[i]));
+        }
+        r->SetWhenList(when_list);
+        r->SetThenList(then_list);
+        r->SetElse(Copy(expr->GetElse()));
+        return r;
+    }
+
+    AstExpr *AstCopier::VisitFuncCall(AstFuncCall *expr) {
+        AstIds name = Copy(expr->GetFuncName());
+        return new AstFuncCall(name, Copy(expr->GetParams()));
+    }
+
+    AstExpr *AstCopier::VisitColumnRef(AstColumnRef *expr) {
+        return new AstColumnRef(Copy(expr->GetColumn()), expr->IsWild());
+    }
+
+    AstIds AstCopier::Copy(const AstIds& ids) {
+        AstIds r;
+        for (auto it : ids) r.push_back(Copy(it));
+        return r;
+    }
+
+    AstExprs AstCopier::Copy(const AstExprs& exprs) {
+        AstExprs r;
+        for (auto it : exprs) r.push_back(Copy(it));
+        return r;
+    }
+
+    /* the constants of the copy must be the literals, one for one, or the shape cannot be cached */
+    static bool match_literals(const std::vector<AstConstantValue*>& slots, const char *sql, const std::vector<FingerprintLiteral>& literals) {
+        if (slots.size() != literals.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < slots.size(); ++i) {
+            AstExpr::EXPR_TYPE tp = literals[i].type == NUMBER ? AstExpr::C_NUMBER : AstExpr::C_STRING;
+            if (slots[i]->GetExprType() != tp || fingerprint_literal(sql, literals[i]) != slots[i]->GetValue()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    StmtCache::StmtCache(size_t capacity, unsigned int shards) {
+        if (shards == 0) {
+            shards = 1;
+        }
+        for (unsigned int i = 0; i < shards; ++i) {
+            _shards.push_back(new Shard);
+        }
+        _shard_capacity = (capacity + shards - 1) / shards;
+        if (_shard_capacity == 0) {
+            _shard_capacity = 1;
+        }
+    }
+
+    StmtCache::~StmtCache() {
+        for (auto it : _shards) delete (it);
+        _shards.clear();
+    }
+
+    AstSelectStmt *BoundStmt::GetStmt() const {
+        return _tmpl->stmt;
+    }
+
+    std::string BoundStmt::GetValue(AstConstantValue *c) const {
+        auto f = _tmpl->slots.find(c);
+        if (f == _tmpl->slots.end() || _literals.empty()) {
+            return c->GetValue();
+        }
+        return fingerprint_literal(_sql, _literals[f->second]);
+    }
+
+    AstSelectStmt *StmtCache::Parse(const char *sql, ParseException *e, Arena *arena) {
+        Fingerprint fp;
+        AstSelectStmt *parsed = nullptr;
+        std::shared_ptr<StmtTemplate> tmpl = Lookup(sql, e, &fp, &parsed, arena);
+        if (parsed != nullptr || !tmpl) {
+            return parsed;
+        }
+        ArenaScope scope(arena);
+        AstCopier copier;
+        copier.sql = sql;
+        copier.literals = &fp.literals;
+        return copier.Copy(tmpl->stmt);
+    }
+
+    bool StmtCache::Bind(const char *sql, ParseException *e, BoundStmt *bound) {
+        Fingerprint fp;
+        AstSelectStmt *parsed = nullptr;
+        Arena scratch;      /* the parsed tree of a miss is not needed, the template is a copy of it */
+        std::shared_ptr<StmtTemplate> tmpl = Lookup(sql, e, &fp, &parsed, &scratch);
+        if (!tmpl) {
+            return false;
+        }
+        bound->_tmpl = tmpl;
+        bound->_sql = sql;
+        bound->_literals.clear();
+        if (parsed == nullptr) {
+            bound->_literals.swap(fp.literals);
+        }
+        return true;
+    }
+
+    std::shared_ptr<StmtTemplate> StmtCache::Lookup(const char *sql, ParseException *e, Fingerprint *result,
+                                                    AstSelectStmt **parsed, Arena *arena) {
+        Fingerprint &fp = *result;
+        fp = fingerprint(sql, e);
+        if (e->_code != ParseException::SUCCESS) {
+            return nullptr;
+        }
+        /* which ? are literals and of what kind is part of the shape, parameters are ? as well */
+        std::string key = fp.text;
+        key += '\0';
+        uint64_t hash = fp.hash;
+        for (auto &it : fp.literals) {
+            char kind = it.type == NUMBER ? 'N' : 'S';
+            key += kind;
+            key += std::to_string(it.pos);
+            hash = (hash ^ (kind + it.pos)) * 1099511628211ULL;
+        }
+        Shard *shard = _shards[hash % _shards.size()];
+        std::shared_ptr<StmtTemplate> tmpl;
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            auto f = shard->map.find(key);
+            if (f != shard->map.end()) {
+                shard->lru.splice(shard->lru.begin(), shard->lru, f->second);
+                tmpl = f->second->second;
+                ++shard->hits;
+            } else {
+                ++shard->misses;
+            }
+        }
+        if (tmpl) {
+            return tmpl;
+        }
+
+        ILex *lex = make_lex(sql);
+        lex->next();
+        AstSelectStmt *stmt = parse_select_stmt(lex, e, arena);
+        bool complete = e->_code == ParseException::SUCCESS && (lex->token()->type() == END_P || lex->token()->type() == SEMI);
+        free_lex(lex);
+        *parsed = stmt;
+        if (!complete) {
+            return nullptr;
+        }
+        tmpl = std::make_shared<StmtTemplate>();
+        AstCopier copier;
+        copier.sql = nullptr;
+        copier.literals = nullptr;
+        {
+            ArenaScope scope(&tmpl->arena);
+            tmpl->stmt = copier.Copy(stmt);
+        }
+        if (!match_literals(copier.slots, sql, fp.literals)) {
+            return tmpl;        /* not cached, its constants are this statement's own */
+        }
+        for (size_t i = 0; i < copier.slots.size(); ++i) {
+            tmpl->slots[copier.slots[i]] = i;
+        }
+        std::shared_ptr<StmtTemplate> evicted;     /* released after the lock */
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        if (shard->map.find(key) == shard->map.end()) {
+            shard->lru.push_front(std::make_pair(key, tmpl));
+            shard->map[key] = shard->lru.begin();
+            if (shard->lru.size() > _shard_capacity) {
+                shard->map.erase(shard->lru.back().first);
+                evicted = shard->lru.back().second;
+                shard->lru.pop_back();
+                ++shard->evictions;
+            }
+        }
+        return tmpl;
+    }
+
+    StmtCache::Stats StmtCache::GetStats() {
+        Stats stats = { 0, 0, 0 };
+        for (auto it : _shards) {
+            std::lock_guard<std::mutex> lock(it->mutex);
+            stats.hits += it->hits;
+            stats.misses += it->misses;
+            stats.evictions += it->evictions;
+        }
+        return stats;
+    }
+}
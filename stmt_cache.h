@@ -0,0 +1,75 @@
+#ifndef GSP_STMT_CACHE_H
+#define GSP_STMT_CACHE_H
+
+#include <stdint.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "fingerprint.h"
+
+namespace GSP {
+    class ParseException;
+    class AstSelectStmt;
+    class AstConstantValue;
+    class Arena;
+    struct StmtTemplate;
+
+    /*
+     * a statement bound to the cached tree of its shape. the tree is shared and read only, its NUMBER and
+     * STRING constants are slots that GetValue() fills from the literals of this statement. the sql given
+     * to StmtCache::Bind() must outlive it
+     */
+    class BoundStmt {
+    public:
+        AstSelectStmt  *GetStmt() const;
+        /* the value of constant c of GetStmt() in this statement */
+        std::string     GetValue(AstConstantValue *c) const;
+    private:
+        friend class StmtCache;
+        std::shared_ptr<StmtTemplate>   _tmpl;
+        const char                     *_sql = nullptr;
+        std::vector<FingerprintLiteral> _literals;      /* empty when the tree holds the values of this statement */
+    };
+
+    /*
+     * LRU cache in front of parse_select_stmt. statements are keyed by their fingerprint and the kind of
+     * each literal, an entry holds the tree of the first statement of that shape. on a hit the parser does
+     * not run: Parse() copies that tree with the literals of the new statement put in, Bind() shares it.
+     */
+    class StmtCache {
+    public:
+        struct Stats {
+            uint64_t    hits;
+            uint64_t    misses;
+            uint64_t    evictions;
+        };
+        StmtCache(size_t capacity, unsigned int shards = 16);
+        ~StmtCache();
+        /* like parse_select_stmt(lex, e, arena) on make_lex(sql), null arena means a heap tree to delete */
+        AstSelectStmt  *Parse(const char *sql, ParseException *e, Arena *arena);
+        /* Parse() without the copy, a hit only binds the literals. false when sql is not one statement */
+        bool            Bind(const char *sql, ParseException *e, BoundStmt *bound);
+        Stats           GetStats();
+    private:
+        StmtCache(const StmtCache&) = delete;
+        StmtCache& operator=(const StmtCache&) = delete;
+        /* the template of the shape of sql, on a miss parsed is the tree parse_select_stmt gave in arena */
+        std::shared_ptr<StmtTemplate>   Lookup(const char *sql, ParseException *e, Fingerprint *fp, AstSelectStmt **parsed, Arena *arena);
+        typedef std::list<std::pair<std::string, std::shared_ptr<StmtTemplate> > > Lru;
+        struct Shard {
+            std::mutex                                          mutex;
+            Lru                                                 lru;    /* most recently used first */
+            std::unordered_map<std::string, Lru::iterator>      map;
+            uint64_t                                            hits = 0;
+            uint64_t                                            misses = 0;
+            uint64_t                                            evictions = 0;
+        };
+        std::vector<Shard*>     _shards;
+        size_t                  _shard_capacity;
+    };
+}
+
+#endif
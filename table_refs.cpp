@@ -0,0 +1,222 @@
+#include "table_refs.h"
+#include "parse_exception.h"
+#include "lex.h"
+
+namespace GSP {
+
+    /* where a frame is in its clause, what the next token may be */
+    enum REF_STATE {
+        S_NONE,             /* select list, conditions, nothing to collect */
+        S_TABLE,            /* a table primary is next: after FROM, JOIN or a comma of the from list */
+        S_NAME,             /* in a dotted name */
+        S_NAME_DOT,
+        S_AFTER_TABLE,      /* an alias may follow */
+        S_ALIAS,            /* after AS */
+        S_FROM,             /* rest of the from list, join conditions */
+        S_CTE_NAME,         /* after WITH or a comma between ctes */
+        S_CTE_AS,           /* after the cte name, its column list or AS */
+        S_CTE_QUERY,        /* after AS, the paren of the cte query */
+        S_CTE_NEXT          /* after a cte query */
+    };
+
+    /* what opened a paren */
+    enum REF_PAREN { P_ROOT, P_PLAIN, P_TABLE, P_CTE_COLUMNS, P_CTE_QUERY };
+
+    struct RefFrame {
+        REF_PAREN       paren;
+        REF_STATE       state;
+        unsigned int    depth;      /* of the query the frame is or is in */
+        bool            query;      /* a SELECT or WITH was seen at this level */
+        bool            nested;     /* inside a query, a query here is a subquery */
+        bool            fresh;      /* no token seen yet */
+        bool            recursive;  /* WITH RECURSIVE */
+        bool            relation;   /* an alias in S_AFTER_TABLE belongs to the last name */
+        size_t          ctes;       /* cte names in scope when the frame was opened */
+    };
+
+    struct RefCte {
+        std::string     name;
+        bool            visible;    /* a cte is in scope inside its own query only when recursive */
+    };
+
+    static bool is_cte(const std::vector<RefCte>& ctes, const std::string& name) {
+        if (name.find('.') != std::string::npos) {
+            return false;
+        }
+        for (auto &it : ctes) {
+            if (it.visible && it.name == name) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<TableRefName> table_refs(const char *sql, ParseException *e) {
+        std::vector<TableRefName> refs;
+        std::vector<RefFrame> frames;
+        std::vector<RefCte> ctes;
+        frames.reserve(16);
+        frames.push_back({P_ROOT, S_NONE, 0, false, false, true, false, false, 0});
+        ILex *lex = make_lex(sql);
+        for (lex->next(); ; lex->next()) {
+            IToken *tk = lex->token();
+            TokenType tp = tk->type();
+            if (tp == ERR) {
+                e->SetFail(END_P, lex);
+                break;
+            }
+            RefFrame *f = &frames.back();
+            if (f->state == S_NAME && tp == DOT) {
+                f->state = S_NAME_DOT;
+                continue;
+            }
+            if (f->state == S_NAME_DOT && tp == ID) {
+                refs.back().name += '.';
+                refs.back().name += tk->word_semantic();
+                f->state = S_NAME;
+                continue;
+            }
+            if (f->state == S_NAME || f->state == S_NAME_DOT) {
+                refs.back().cte = is_cte(ctes, refs.back().name);
+                f->state = S_AFTER_TABLE;
+                f->relation = true;
+            }
+            if (tp == END_P || tp == SEMI) {
+                if (frames.size() > 1) {
+                    e->SetFail(RPAREN, lex);
+                }
+                break;
+            }
+            if (f->fresh) {
+                f->fresh = false;
+                if (tp == SELECT || tp == WITH) {
+                    f->query = true;
+                    f->depth += f->nested ? 1 : 0;
+                    f->state = S_NONE;
+                }
+            }
+
+            switch (f->state) {
+                case S_TABLE:
+                    if (tp == ID) {
+                        refs.push_back({tk->word_semantic(), std::string(), f->depth, false});
+                        f->state = S_NAME;
+                        continue;
+                    }
+                    if (tp == LPAREN) {
+                        frames.push_back({P_TABLE, S_TABLE, f->depth, false, f->query || f->nested, true, false, false, ctes.size()});
+                        continue;
+                    }
+                    f->state = S_FROM;
+                    break;
+                case S_AFTER_TABLE:
+                    if (tp == AS) {
+                        f->state = S_ALIAS;
+                        continue;
+                    }
+                    /* fall through */
+                case S_ALIAS:
+                    f->state = S_FROM;
+                    if (tp == ID) {
+                        if (f->relation) {
+                            refs.back().alias = tk->word_semantic();
+                        }
+                        continue;
+                    }
+                    break;
+                case S_CTE_NAME:
+                    if (tp == RECURSIVE) {
+                        f->recursive = true;
+                        continue;
+                    }
+                    if (tp == ID) {
+                        ctes.push_back({tk->word_semantic(), f->recursive});
+                        f->state = S_CTE_AS;
+                        continue;
+                    }
+                    break;
+                case S_CTE_AS:
+                    if (tp == LPAREN) {
+                        frames.push_back({P_CTE_COLUMNS, S_NONE, f->depth, false, f->query || f->nested, true, false, false, ctes.size()});
+                        continue;
+                    }
+                    if (tp == AS) {
+                        f->state = S_CTE_QUERY;
+                        continue;
+                    }
+                    break;
+                case S_CTE_QUERY:
+                    if (tp == LPAREN) {
+                        frames.push_back({P_CTE_QUERY, S_NONE, f->depth, false, f->query || f->nested, true, false, false, ctes.size()});
+                        continue;
+                    }
+                    break;
+                case S_CTE_NEXT:
+                    if (tp == COMMA) {
+                        f->state = S_CTE_NAME;
+                        continue;
+                    }
+                    f->state = S_NONE;
+                    break;
+                default:
+                    break;
+            }
+
+            switch (tp) {
+                case LPAREN:
+                    frames.push_back({P_PLAIN, S_NONE, f->depth, false, f->query || f->nested, true, false, false, ctes.size()});
+                    break;
+                case RPAREN: {
+                    if (frames.size() == 1) {
+                        e->SetFail(END_P, lex);
+                        free_lex(lex);
+                        return refs;
+                    }
+                    REF_PAREN paren = f->paren;
+                    ctes.resize(f->ctes);
+                    frames.pop_back();
+                    f = &frames.back();
+                    if (paren == P_TABLE) {
+                        /* a derived table or a parenthesized join, its alias names no relation */
+                        f->state = S_AFTER_TABLE;
+                        f->relation = false;
+                    } else if (paren == P_CTE_QUERY) {
+                        ctes.back().visible = true;
+                        f->state = S_CTE_NEXT;
+                    }
+                }
+                    break;
+                case SELECT:
+                    if (!f->query) {
+                        /* a parenthesized query continued by a set operator */
+                        f->query = true;
+                        f->depth += f->nested ? 1 : 0;
+                    }
+                    f->state = S_NONE;
+                    break;
+                case WITH:
+                    f->state = S_CTE_NAME;
+                    break;
+                case FROM:
+                    if (f->query) {
+                        f->state = S_TABLE;
+                    }
+                    break;
+                case JOIN:
+                case COMMA:
+                    if (f->state == S_FROM) {
+                        f->state = S_TABLE;
+                    }
+                    break;
+                case WHERE: case GROUP: case HAVING: case ORDER:
+                case UNION: case EXCEPT: case INTERSECT:
+                    f->state = S_NONE;
+                    break;
+                default:
+                    break;
+            }
+        }
+        free_lex(lex);
+        return refs;
+    }
+}
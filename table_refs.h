@@ -0,0 +1,26 @@
+#ifndef GSP_TABLE_REFS_H
+#define GSP_TABLE_REFS_H
+
+#include <string>
+#include <vector>
+
+namespace GSP {
+    class ParseException;
+
+    struct TableRefName {
+        std::string     name;   /* dotted, the parts as word_semantic() */
+        std::string     alias;  /* empty when none */
+        unsigned int    depth;  /* 0 in the outer query, one more per enclosing subquery */
+        bool            cte;    /* names a common table expression in scope, not a table */
+    };
+
+    /*
+     * the relations the first statement of sql reads, up to ; or the end, in source order. a scan of the
+     * tokens that follows FROM lists, joins, derived tables and WITH clauses, no ast is built. it does not
+     * check the grammar, a statement the parser rejects may still give names; e fails on a bad token or
+     * unbalanced parens.
+     */
+    std::vector<TableRefName>   table_refs  (const char *sql, ParseException *e);
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "sql_table_ref.h"
 #include "sql_expression.h"
 #include "relational_algebra.h"
+#include "visitor.h"
 #include <assert.h>
 
 namespace GSP {
@@ -19,25 +20,59 @@ namespace GSP {
         return ra_query;
     }
 
-    RelationAlgebraOperator *translate_query_body(AstQueryExpressionBody *body, TranslateException *e) {
-        switch (body->GetSetType()) {
-            case AstQueryExpressionBody::SIMPLE: {
-                return translate_query_primary(dynamic_cast<AstQueryPrimary*>(body), e);
-            } break;
-            case AstQueryExpressionBody::UNION_ALL: {
-                return translate_query_set(dynamic_cast<AstQuerySet*>(body), e);
-            } break;
-            default: { assert(false); }
+    struct Translator : public AstVisitor<Translator, RelationAlgebraOperator*> {
+        TranslateException *e;
+
+        RelationAlgebraOperator *VisitQueryPrimary(AstQueryPrimary *primary) { return translate_query_primary(primary, e); }
+        RelationAlgebraOperator *VisitQuerySet(AstQuerySet *set) { return translate_query_set(set, e); }
+
+        RelationAlgebraOperator *VisitSubQueryTableRef(AstSubQueryTableRef *subquery) { return translate(subquery->GetQuery(), e); }
+        RelationAlgebraOperator *VisitTableJoin(AstTableJoin *join) {
+            if (join->GetJoinType() != AstTableRef::CROSS_JOIN) {
+                return Fail("join with a condition");
+            }
+            RelationAlgebraOperator *left = Visit(join->GetLeft());
+            if (left == nullptr) {
+                return nullptr;
+            }
+            RelationAlgebraOperator *right = Visit(join->GetRight());
+            if (right == nullptr) {
+                delete (left);
+                return nullptr;
+            }
+            auto cross = new RelationAlgebraCrossJoin();
+            cross->SetLeftInput(left);
+            cross->SetRightInput(right);
+            return cross;
+        }
+        /* base relations and the rest */
+        RelationAlgebraOperator *VisitTableRef(AstTableRef *table_ref) { return Fail("table reference"); }
+
+        RelationAlgebraOperator *Fail(const char *detail) {
+            if (e->_code == TranslateException::SUCCESS) {
+                e->_code = TranslateException::FAIL;
+                e->_detail = std::string(detail) + " not supported";
+            }
+            return nullptr;
         }
+    };
+
+    RelationAlgebraOperator *translate_query_body(AstQueryExpressionBody *body, TranslateException *e) {
+        Translator translator;
+        translator.e = e;
+        return translator.Visit(body);
     }
 
     RelationAlgebraOperator *translate_query_set(AstQuerySet *body, TranslateException *e) {
         RelationAlgebraUnion *un = new RelationAlgebraUnion;
         switch (body->GetSetType()) {
             case AstQueryExpressionBody::UNION_ALL: {
-                AstQueryExpressionBody *left = body->GetLeft(), *right = body->GetRight();
                 un->SetLeftInput(translate_query_body(body->GetLeft(), e));
                 un->SetRightInput(translate_query_body(body->GetRight(), e));
+                if (e->_code != TranslateException::SUCCESS) {
+                    delete (un);
+                    return nullptr;
+                }
             } break;
             default: { assert(false); }
         }
@@ -47,12 +82,23 @@ namespace GSP {
     RelationAlgebraOperator *translate_query_primary(AstQueryPrimary *primary, TranslateException *e) {
         assert(primary->GetFrom().size() > 0);
         RelationAlgebraOperator *r = translate_table_ref(primary->GetFrom()[0], e);
-        for (size_t i = 1; i < primary->GetFrom().size(); ++i) {
+        for (size_t i = 1; r != nullptr && i < primary->GetFrom().size(); ++i) {
             RelationAlgebraOperator *left = r;
             RelationAlgebraOperator *right = translate_table_ref(primary->GetFrom()[i], e);
+            if (right == nullptr) {
+                delete (left);
+                return nullptr;
+            }
             auto cross = new RelationAlgebraCrossJoin();
             cross->SetLeftInput(left); cross->SetRightInput(right);
             r = cross;
         }
+        return r;
+    }
+
+    RelationAlgebraOperator *translate_table_ref(AstTableRef *table_ref, TranslateException *e) {
+        Translator translator;
+        translator.e = e;
+        return translator.Visit(table_ref);
     }
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
 #ifndef TRANSLATE_H
 #define TRANSLATE_H
 
+#include <string>
+
 namespace GSP {
     class AstSelectStmt;
     class RelationAlgebraOperator;
 
+    /* FAIL on what has no relational algebra yet, the result is then nullptr */
     struct TranslateException {
-
+        enum { SUCCESS, FAIL } _code = SUCCESS;
+        std::string     _detail;
     };
 
     RelationAlgebraOperator *translate(AstSelectStmt *query, TranslateException *e);
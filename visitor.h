@@ -0,0 +1,128 @@
+#ifndef GSP_VISITOR_H
+#define GSP_VISITOR_H
+
+#include <assert.h>
+#include "sql_expression.h"
+#include "sql_table_ref.h"
+#include "sql_select_stmt.h"
+
+namespace GSP {
+
+    /*
+     * static dispatch over the ast. Visit() switches on the type enums and static_casts to the node
+     * class, no rtti is involved, so passes built on it compile with -fno-rtti.
+     *
+     *     struct CountColumns : public AstVisitor<CountColumns, int> {
+     *         int VisitColumnRef(AstColumnRef *col) { return 1; }
+     *         int VisitBinaryOp(AstBinaryOpExpr *expr) { return Visit(expr->GetLeft()) + Visit(expr->GetRight()); }
+     *     };
+     *
+     * a derived class hides the Visit* it handles. the others fall back to VisitExpr, VisitTableRef or
+     * VisitQueryBody, which return R().
+     */
+    template <typename Derived, typename R = void>
+    class AstVisitor {
+    public:
+        R Visit(AstExpr *expr);
+        R Visit(AstTableRef *table_ref);
+        R Visit(AstQueryExpressionBody *body);
+
+        /* expressions */
+        R VisitExpr(AstExpr *expr) { return R(); }
+        R VisitBinaryOp(AstBinaryOpExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitUnaryOp(AstUnaryOpExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitQuantifiedCompare(AstQuantifiedCompareExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitExists(AstExistsExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitIn(AstInExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitBetween(AstBetweenExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitLike(AstLikeExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitConstant(AstConstantValue *expr) { return derived()->VisitExpr(expr); }
+        R VisitSubquery(AstSubqueryExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitExprList(AstExprList *expr) { return derived()->VisitExpr(expr); }
+        R VisitCase(AstCaseExpr *expr) { return derived()->VisitExpr(expr); }
+        R VisitFuncCall(AstFuncCall *expr) { return derived()->VisitExpr(expr); }
+        R VisitColumnRef(AstColumnRef *expr) { return derived()->VisitExpr(expr); }
+
+        /* table references */
+        R VisitTableRef(AstTableRef *table_ref) { return R(); }
+        R VisitRelation(AstRelation *relation) { return derived()->VisitTableRef(relation); }
+        R VisitSubQueryTableRef(AstSubQueryTableRef *subquery) { return derived()->VisitTableRef(subquery); }
+        R VisitTableJoin(AstTableJoin *join) { return derived()->VisitTableRef(join); }
+
+        /* query expression bodies */
+        R VisitQueryBody(AstQueryExpressionBody *body) { return R(); }
+        R VisitQueryPrimary(AstQueryPrimary *primary) { return derived()->VisitQueryBody(primary); }
+        R VisitQuerySet(AstQuerySet *set) { return derived()->VisitQueryBody(set); }
+    private:
+        Derived *derived() { return static_cast<Derived*>(this); }
+    };
+
+    template <typename Derived, typename R>
+    R AstVisitor<Derived, R>::Visit(AstExpr *expr) {
+        switch (expr->GetExprType()) {
+            case AstExpr::OR: case AstExpr::AND:
+            case AstExpr::COMP_LE: case AstExpr::COMP_LT: case AstExpr::COMP_GE:
+            case AstExpr::COMP_GT: case AstExpr::COMP_EQ: case AstExpr::COMP_NEQ:
+            case AstExpr::PLUS: case AstExpr::MINUS: case AstExpr::BARBAR: case AstExpr::MUL:
+            case AstExpr::DIV: case AstExpr::REM: case AstExpr::MOD: case AstExpr::CARET:
+                return derived()->VisitBinaryOp(static_cast<AstBinaryOpExpr*>(expr));
+            case AstExpr::NOT:
+            case AstExpr::IS_TRUE: case AstExpr::IS_NOT_TRUE: case AstExpr::IS_FALSE: case AstExpr::IS_NOT_FALSE:
+            case AstExpr::IS_UNKNOWN: case AstExpr::IS_NOT_UNKNOWN: case AstExpr::IS_NULL: case AstExpr::IS_NOT_NULL:
+            case AstExpr::U_POSITIVE: case AstExpr::U_NEGATIVE:
+                return derived()->VisitUnaryOp(static_cast<AstUnaryOpExpr*>(expr));
+            case AstExpr::COMP_LE_ALL: case AstExpr::COMP_LT_ALL: case AstExpr::COMP_GE_ALL:
+            case AstExpr::COMP_GT_ALL: case AstExpr::COMP_EQ_ALL: case AstExpr::COMP_NEQ_ALL:
+            case AstExpr::COMP_LE_SOME: case AstExpr::COMP_LT_SOME: case AstExpr::COMP_GE_SOME:
+            case AstExpr::COMP_GT_SOME: case AstExpr::COMP_EQ_SOME: case AstExpr::COMP_NEQ_SOME:
+            case AstExpr::COMP_LE_ANY: case AstExpr::COMP_LT_ANY: case AstExpr::COMP_GE_ANY:
+            case AstExpr::COMP_GT_ANY: case AstExpr::COMP_EQ_ANY: case AstExpr::COMP_NEQ_ANY:
+                return derived()->VisitQuantifiedCompare(static_cast<AstQuantifiedCompareExpr*>(expr));
+            case AstExpr::LIKE: case AstExpr::NOT_LIKE:
+                return derived()->VisitLike(static_cast<AstLikeExpr*>(expr));
+            case AstExpr::BETWEEN: case AstExpr::NOT_BETWEEN:
+                return derived()->VisitBetween(static_cast<AstBetweenExpr*>(expr));
+            case AstExpr::IN: case AstExpr::NOT_IN:
+                return derived()->VisitIn(static_cast<AstInExpr*>(expr));
+            case AstExpr::EXISTS:
+                return derived()->VisitExists(static_cast<AstExistsExpr*>(expr));
+            case AstExpr::C_QUES: case AstExpr::C_TRUE: case AstExpr::C_FALSE: case AstExpr::C_UNKNOWN:
+            case AstExpr::C_DEFAULT: case AstExpr::C_NULL: case AstExpr::C_NUMBER: case AstExpr::C_STRING:
+                return derived()->VisitConstant(static_cast<AstConstantValue*>(expr));
+            case AstExpr::EXPR_SUBQUERY:
+                return derived()->VisitSubquery(static_cast<AstSubqueryExpr*>(expr));
+            case AstExpr::EXPR_LIST:
+                return derived()->VisitExprList(static_cast<AstExprList*>(expr));
+            case AstExpr::EXPR_CASE:
+                return derived()->VisitCase(static_cast<AstCaseExpr*>(expr));
+            case AstExpr::EXPR_FUNC:
+                return derived()->VisitFuncCall(static_cast<AstFuncCall*>(expr));
+            case AstExpr::EXPR_COLUMN_REF:
+                return derived()->VisitColumnRef(static_cast<AstColumnRef*>(expr));
+        }
+        assert(false);
+        return derived()->VisitExpr(expr);
+    }
+
+    template <typename Derived, typename R>
+    R AstVisitor<Derived, R>::Visit(AstTableRef *table_ref) {
+        switch (table_ref->GetTableRefType()) {
+            case AstTableRef::RELATION:
+                return derived()->VisitRelation(static_cast<AstRelation*>(table_ref));
+            case AstTableRef::SUBQUERY:
+                return derived()->VisitSubQueryTableRef(static_cast<AstSubQueryTableRef*>(table_ref));
+            default:
+                return derived()->VisitTableJoin(static_cast<AstTableJoin*>(table_ref));
+        }
+    }
+
+    template <typename Derived, typename R>
+    R AstVisitor<Derived, R>::Visit(AstQueryExpressionBody *body) {
+        if (body->GetSetType() == AstQueryExpressionBody::SIMPLE) {
+            return derived()->VisitQueryPrimary(static_cast<AstQueryPrimary*>(body));
+        }
+        return derived()->VisitQuerySet(static_cast<AstQuerySet*>(body));
+    }
+}
+
+#endif